@@ -7,6 +7,7 @@ extern "C" {
 
 #include <stdint.h>
 #include <stdbool.h>
+#include "config.h"
 
 typedef struct setpoint_s {
 	float roll;
@@ -15,14 +16,116 @@ typedef struct setpoint_s {
 	uint16_t thrust;
 }__attribute__((packed)) setpoint_t;
 
+typedef enum {
+	CAR_AXIS_PITCH,		// Forward
+	CAR_AXIS_ROLL,		// Sideways, to the left
+	CAR_AXIS_YAW,		// Rotation
+	CAR_AXIS_COUNT,
+} CarAxis;
+
+typedef enum {
+	CAR_CHASSIS_MECANUM,
+	CAR_CHASSIS_SKID_STEER,
+	CAR_CHASSIS_DIFFERENTIAL,
+	CAR_CHASSIS_COUNT,
+} CarChassis;
+
+/**
+ * Kinematics of the chassis, the contribution of each axis to each motor.
+ * Coefficients are floats. carSetMixer clamps them to [-2, 2) and quantises
+ * them to Q14, carGetMixer returns the quantised values. carSet, carMove and
+ * carRotate all go through it, a motor that would exceed the command range
+ * scales the other three down with it instead of being clipped alone.
+ */
+typedef float CarMixer[MOTOR_NBR][CAR_AXIS_COUNT];
+
 void motorInit();
+/**
+ * Outputs of all motors change together: motorStage() records the command of
+ * one motor and motorCommit() hands all of them to the timers, which apply
+ * them at the start of the next PWM period. motorSetRatio() does both.
+ */
+void motorStage(uint8_t id, int16_t thrust);
+void motorCommit();
 void motorSetRatio(uint8_t id, int16_t thrust);
+
+/**
+ * Reprogram the motor timers for 'frequency' Hz PWM with 'steps' compare
+ * steps per period, or with the most steps the timer clocks allow when
+ * 'steps' is 0. The timers restart in step and the motors keep their
+ * commands, now scaled to the new period.
+ *
+ * @return The frequency achieved, 0 if the timers cannot produce it
+ */
+uint32_t motorSetPwm(uint32_t frequency, uint32_t steps);
+
+#define MOTOR_LUT_POINTS 17
+
+/**
+ * Calibration of one motor in one direction, from command to output. point[i]
+ * is the output for a command of i / (MOTOR_LUT_POINTS - 1) of full scale,
+ * commands in between are interpolated. A command of 0 always gives 0, so
+ * point[0] is where the motor leaves its deadband. Points must not decrease
+ * and stay below MOTOR_MAX_THRUST. The default tables rise linearly from
+ * MOTOR_LUT_DEADBAND.
+ */
+typedef struct {
+	uint16_t point[MOTOR_LUT_POINTS];
+} MotorLut;
+
+/** @return false, leaving the table unchanged, if 'lut' is not valid */
+bool motorSetLut(uint8_t id, bool backward, const MotorLut *lut);
+void motorGetLut(uint8_t id, bool backward, MotorLut *lut);
+/** Default tables on all motors, done by motorInit */
+void motorResetLut();
+
+/**
+ * Drive motor 'id' with a raw output, bypassing its table, and hold the
+ * others at 0 whatever they are commanded. For calibration sweeps, an 'id'
+ * of -1 returns to the commands. Applied by the next motorCommit().
+ * @return false, leaving the motors to the commands, once the override was
+ * aborted. Only an 'id' of -1 starts over.
+ */
+bool motorSetOverride(int id, int16_t output);
+/**
+ * Return to the commands and refuse the override until it is released, so
+ * every stop of the controller also stops a sweep. Safe from interrupts.
+ */
+void motorAbortOverride();
+bool motorIsOverrideAborted();
 void carSet(setpoint_t *sp);
 void carMove(int16_t v, int dir);
 void carRotate(int16_t r);
 void carStart();
 void carStop();
 
+/** Select one of the built in mixers, motorInit selects CAR_CHASSIS */
+void carSetChassis(CarChassis chassis);
+/**
+ * Any other chassis, takes effect from the next command. A mix in progress
+ * finishes with the previous mixer, provided no second carSetMixer() comes
+ * before it ends: only two tables are kept.
+ */
+void carSetMixer(const CarMixer mixer);
+void carGetMixer(CarMixer mixer);
+
+typedef struct {
+	uint32_t samples;
+	uint32_t floatCycles;			// Cycle counter ticks over all samples, ns on the host build
+	uint32_t fixedCycles;
+	uint32_t commandMismatches;		// Motor commands that differ between the two paths
+	uint32_t saturationMismatches;	// Motors saturated by one path only
+	uint32_t compareMismatches;		// Compare register values that differ
+	uint32_t maxCommandError;
+} CarBenchmark;
+
+/**
+ * Run 'samples' setpoints through the integer mixer of carSet and through
+ * the float reference it replaced, without touching the timers. Times both
+ * with the cycle counter and compares their motor commands and compare values.
+ */
+void carBenchmark(uint32_t samples, CarBenchmark *result);
+
 #ifdef __cplusplus
 }
 #endif
@@ -10,8 +10,14 @@ typedef enum {
 } DIRECTION;
 
 #define MOTOR_NBR 4
-#define MOTOR_TIM_PERIOD 1000
-#define MOTOR_MAX_THRUST (1 << 15) // int16
+#define MOTOR_PWM_FREQUENCY 20000	// Hz, programmed by motorInit
+#define MOTOR_PWM_STEPS 0			// Compare steps per period, 0 for the most the timer clocks allow
+#define MOTOR_PWM_MAX_STEPS 65536	// 16 bit auto-reload of TIM1
+#define MOTOR_LUT_DEADBAND 18000	// Output of the default tables just above a zero command
+#define MOTOR_THRUST_BITS 15
+#define MOTOR_MAX_THRUST (1 << MOTOR_THRUST_BITS) // int16
+
+#define CAR_CHASSIS CAR_CHASSIS_MECANUM	// Mixer selected by motorInit, see CarChassis
 
 #define MOTOR1_F_TIM	 htim1
 #define MOTOR1_B_TIM	 htim1
@@ -35,6 +41,18 @@ typedef enum {
 
 #define debugUart       huart2
 
+/**
+ * CRTP over USART2 next to USB, for a radio modem on PD5/PD6. The debug
+ * printer is silenced since it shares the UART. 1 Mbaud divides APB1 (42 MHz)
+ * exactly at 16x oversampling.
+ */
+// #define CRTP_LINK_UART
+#define uartlinkUart    huart2
+#define UARTLINK_BAUDRATE 1000000
+/*! DTR output of the modem, low while a host has the port open. Without it the UART link is always up */
+// #define UARTLINK_DTR_PORT GPIOD
+// #define UARTLINK_DTR_PIN  GPIO_PIN_3
+
 
 #define SYSTEM_TASK_STACKSIZE   (2 * configMINIMAL_STACK_SIZE)
 #define SYSTEM_TASK_PRI         2
@@ -43,19 +61,39 @@ typedef enum {
 #define CRTP_TX_TASK_NAME       "CRTP-TX"
 #define CRTP_RX_TASK_NAME       "CRTP-RX"
 #define CRTP_RXTX_TASK_NAME     "CRTP-RXTX"
+#define CRTP_RX1_TASK_NAME      "CRTP-RX1"
 #define CRTP_TX_TASK_PRI        2
 #define CRTP_RX_TASK_PRI        2
 #define CRTP_TX_TASK_STACKSIZE        configMINIMAL_STACK_SIZE
 #define CRTP_RX_TASK_STACKSIZE        (2 * configMINIMAL_STACK_SIZE)
 #define CRTP_RXTX_TASK_STACKSIZE      configMINIMAL_STACK_SIZE
+#define CRTP_LINK_TIMEOUT_MS    1000    // A link that received nothing for this long is no longer preferred by routes
 
 #define USBLINK_TASK_NAME       "USBLINK"
 #define USBLINK_TASK_PRI        3
 #define USBLINK_TASK_STACKSIZE  configMINIMAL_STACK_SIZE
 
+#define UARTLINK_TASK_NAME      "UARTLINK"
+#define UARTLINK_TASK_PRI       3
+#define UARTLINK_TASK_STACKSIZE configMINIMAL_STACK_SIZE
+
+#define CRTP_SRV_TASK_NAME      "CRTP-SRV"
+#define CRTP_SRV_TASK_PRI       1
+#define CRTP_SRV_TASK_STACKSIZE configMINIMAL_STACK_SIZE
+
+#define DEFERLOG_TASK_NAME      "DEFERLOG"
+#define DEFERLOG_TASK_PRI       1
+#define DEFERLOG_TASK_STACKSIZE (2 * configMINIMAL_STACK_SIZE)
+
+#define MOTORCAL_TASK_NAME      "MOTORCAL"
+#define MOTORCAL_TASK_PRI       1
+#define MOTORCAL_TASK_STACKSIZE (2 * configMINIMAL_STACK_SIZE)
+
 #define CONTROLLER_TASK_NAME	"CONTROLLER"
 #define CONTROLLER_TASK_PRI		3
 #define CONTROLLER_TASK_STACKSIZE configMINIMAL_STACK_SIZE
+#define CONTROLLER_RATE_HZ		500	// Must divide the kernel tick rate
+#define CONTROLLER_FAST_PATH	1	// Setpoints go from the link task to the mailbox, 0 to go through crtpRxTask
 
 #ifdef __cplusplus
 }
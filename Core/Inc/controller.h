@@ -2,7 +2,60 @@
 #define __CONTROLLER_H__
 
 #include <stdbool.h>
+#include <stdint.h>
+#include "car_driver.h"
+#include "histogram.h"
+
+typedef struct {
+	uint32_t received;		// setpoints written to the mailbox
+	uint32_t applied;		// setpoints sent to the motors
+	uint32_t superseded;	// setpoints overwritten before the controller saw them
+} ControllerStats;
 
 void controllerInit();
 
-#endif
\ No newline at end of file
+/**
+ * Publish a new setpoint. The mailbox has a single slot: a setpoint not yet
+ * picked up by the controller is overwritten. The schedule is dropped, so its
+ * remaining entries can not override the setpoint later. Safe from tasks and
+ * interrupts.
+ */
+void controllerSetpointPut(const setpoint_t *sp);
+
+/**
+ * Same as controllerSetpointPut() for a setpoint decoded from a received
+ * packet, 'rxStamp' being its link reception time for the latency trace.
+ */
+void controllerSetpointPutRx(const setpoint_t *sp, uint32_t rxStamp);
+
+/**
+ * Stop the motors until the next setpoint, and drop the schedule and the
+ * trajectory.
+ */
+void controllerStop(void);
+
+/**
+ * Replace the schedule of future setpoints. Each one is published when the
+ * control loop reaches its tick, 'due' must be in increasing order. Safe from
+ * tasks and interrupts.
+ */
+void controllerSchedule(const setpoint_t *sp, const uint32_t *due, int count);
+
+/**
+ * The setpoint the control loop applied last, from the mailbox or from the
+ * trajectory executor. All zeros while the motors are stopped, including
+ * after the setpoint timeout. Safe from tasks and interrupts.
+ */
+void controllerGetOutput(setpoint_t *sp);
+
+void controllerGetStats(ControllerStats *stats);
+
+/**
+ * Copy the control loop timing: deviation of each period from the nominal
+ * 1/CONTROLLER_RATE_HZ, and execution time of each iteration, both in us.
+ */
+void controllerGetTiming(Histogram *jitter, Histogram *exec);
+
+void controllerResetTiming(void);
+
+#endif
@@ -71,10 +71,78 @@ typedef struct _CRTPPacket {
     };
     uint8_t raw[CRTP_MAX_DATA_SIZE + 1];  //< The full packet "raw"
   };
+  uint8_t link;                         //< CRTP_LINK_ROUTE, or 1 + index of the link it came in on
 } __attribute__((packed)) CRTPPacket;
 
+/**
+ * Links that can run at the same time. A packet received on a link keeps its
+ * origin in 'link', so a reply built from it goes back the same way. Other
+ * packets follow the route of their port.
+ *
+ * 'link' is local and never sent, 'raw' alone is the wire layout. It is 0 for
+ * CRTP_LINK_ROUTE, so packets taken from the pool or zero initialised follow
+ * their route. A packet built on the stack must start from CRTP_PACKET_INIT.
+ */
+#define CRTP_MAX_LINKS 2
+#define CRTP_LINK_ROUTE 0
+#define CRTP_LINK_MASK(index) (1 << (index))
+#define CRTP_LINK_ALL ((1 << CRTP_MAX_LINKS) - 1)
+
+#define CRTP_PACKET_INIT(port_, channel_) { .header = CRTP_HEADER(port_, channel_), .link = CRTP_LINK_ROUTE }
+
 typedef void (*CrtpCallback)(CRTPPacket *);
 
+/**
+ * Fast path handler, see crtpRegisterFastPath().
+ *
+ * @param[in] rxStamp Cycle counter when the link received the packet, 0 if unknown
+ */
+typedef void (*CrtpFastCallback)(const CRTPPacket *p, uint32_t rxStamp);
+
+#define CRTP_NBR_OF_CHANNELS 4
+/*! Callbacks that can share one (port, channel) */
+#define CRTP_MAX_SUBSCRIBERS 2
+
+/**
+ * Outgoing priority classes. The TX task always sends from the highest
+ * priority non-empty lane, so control traffic never waits behind bulk data.
+ */
+typedef enum {
+  CRTP_TX_LANE_CONTROL = 0,   //< Link control, setpoint acknowledgements
+  CRTP_TX_LANE_TELEMETRY,     //< Log and param data
+  CRTP_TX_LANE_BULK,          //< Console and memory transfers
+  CRTP_TX_LANE_COUNT,
+} CrtpTxLane;
+
+/**
+ * What crtpRxTask does when a port queue is full.
+ */
+typedef enum {
+  CRTP_QUEUE_BLOCK = 0,         //< Wait for room, stalls reception on every port
+  CRTP_QUEUE_DROP_OLDEST,       //< Drop the oldest queued packet to make room
+  CRTP_QUEUE_DROP_NEWEST,       //< Drop the incoming packet
+  CRTP_QUEUE_OVERWRITE_LATEST,  //< Single entry queue, always holding the latest packet
+} CrtpQueuePolicy;
+
+typedef struct {
+  uint16_t count;       //< Packets currently queued
+  uint16_t highWater;   //< Highest number of packets queued at once
+  uint32_t dropped;     //< Packets refused because the lane or the pool was full
+} CrtpTxLaneStats;
+
+/**
+ * Traffic counters of one port. Byte counts include the CRTP header.
+ */
+typedef struct {
+  uint32_t rxPackets;     //< Packets received from the link
+  uint32_t rxBytes;
+  uint32_t rxDropped;     //< Packets dropped by the port queue policy
+  uint32_t txPackets;     //< Packets handed to the link
+  uint32_t txBytes;
+  uint32_t txDropped;     //< Packets refused because the lane or the pool was full
+  uint16_t rxHighWater;   //< Highest number of packets waiting in the port queue
+} CrtpPortStats;
+
 /**
  * Initialize the CRTP stack
  */
@@ -83,24 +151,89 @@ void crtpInit(void);
 bool crtpTest(void);
 
 /**
- * Initializes the queue and dispatch of an task.
+ * Initializes the queue and dispatch of an task. The queue blocks reception
+ * when full, see crtpInitTaskQueuePolicy() for the alternatives.
  *
  * @param[in] taskId The id of the CRTP task
  */
 void crtpInitTaskQueue(CRTPPort taskId);
 
 /**
- * Register a callback to be called for a particular port.
+ * Initializes the queue and dispatch of an task with an overflow policy.
+ *
+ * @param[in] taskId The id of the CRTP task
+ * @param[in] policy What to do with incoming packets when the queue is full
+ */
+void crtpInitTaskQueuePolicy(CRTPPort taskId, CrtpQueuePolicy policy);
+
+/**
+ * Get the number of packets a port queue has dropped because of its policy
+ *
+ * @param[in] taskId The id of the CRTP task
+ */
+uint32_t crtpGetPortDropped(CRTPPort taskId);
+
+/**
+ * Get the traffic counters of a port
+ *
+ * @param[in]  port  Crtp port
+ * @param[out] stats Counters since boot
+ */
+void crtpGetPortStats(CRTPPort port, CrtpPortStats *stats);
+
+/**
+ * @return Number of times the TX task found the link busy and had to try again
+ */
+uint32_t crtpGetLinkRetries(void);
+
+/**
+ * Register a callback to be called for a particular port, on all its channels.
  *
  * @param[in] port Crtp port for which the callback is set
  * @param[in] cb Callback that will be called when a packet is received on
  *            'port'.
  *
- * @note Only one callback can be registered per port! The last callback
- *       registered will be the one called
+ * @note Same as crtpSubscribe() on every channel, asserts that none of them
+ *       already holds CRTP_MAX_SUBSCRIBERS callbacks
  */
 void crtpRegisterPortCB(int port, CrtpCallback cb);
 
+/**
+ * Add a callback for packets of (port, channel). crtpRxTask calls every
+ * subscriber in registration order, then queues the packet to the port task if
+ * there is one. Callbacks run in crtpRxTask and must not block. A callback
+ * may take the slot of an unsubscribed one, and then runs in its place.
+ *
+ * @return 0 on success, -1 if the channel already has CRTP_MAX_SUBSCRIBERS
+ */
+int crtpSubscribe(CRTPPort port, uint8_t channel, CrtpCallback cb);
+
+/**
+ * Remove a callback added by crtpSubscribe(). Safe while crtpRxTask runs, it
+ * may still call 'cb' for a packet it was already dispatching.
+ */
+void crtpUnsubscribe(CRTPPort port, uint8_t channel, CrtpCallback cb);
+
+/**
+ * Opt a (port, channel) into the fast path: the link calls 'cb' from its own
+ * receive task as soon as the packet is parsed, and the packet goes no further.
+ * It skips the packet pool, crtpRxTask, the port callback and the port queue,
+ * so 'cb' must only decode and publish, never block.
+ *
+ * @param[in] cb Handler, NULL to put the channel back on the task path
+ */
+void crtpRegisterFastPath(CRTPPort port, uint8_t channel, CrtpFastCallback cb);
+
+/**
+ * Called by the links for every parsed packet, before allocating it.
+ *
+ * @param[in] raw CRTP header followed by the data
+ * @param[in] length Size of 'raw', header included
+ *
+ * @return true if a fast path handler consumed the packet
+ */
+bool crtpDispatchFast(const uint8_t *raw, uint8_t length, uint32_t rxStamp);
+
 /**
  * Put a packet in the TX task
  *
@@ -110,6 +243,30 @@ void crtpRegisterPortCB(int port, CrtpCallback cb);
  */
 int crtpSendPacket(CRTPPacket *p);
 
+/**
+ * Put a packet in a given TX lane, overriding the lane of its port
+ *
+ * @param[in] p    CRTPPacket to send
+ * @param[in] lane Priority lane to queue it in
+ */
+int crtpSendPacketLane(CRTPPacket *p, CrtpTxLane lane);
+
+/**
+ * Select the TX lane used for packets sent on a port
+ *
+ * @param[in] port Crtp port
+ * @param[in] lane Priority lane used by crtpSendPacket() for this port
+ */
+void crtpSetPortTxLane(CRTPPort port, CrtpTxLane lane);
+
+/**
+ * Get the occupancy of a TX lane
+ *
+ * @param[in]  lane  Priority lane
+ * @param[out] stats Current count, high-water mark and drops of the lane
+ */
+void crtpGetTxLaneStats(CrtpTxLane lane, CrtpTxLaneStats *stats);
+
 /**
  * Put a packet in the TX task
  *
@@ -117,6 +274,14 @@ int crtpSendPacket(CRTPPacket *p);
  */
 int crtpSendPacketBlock(CRTPPacket *p);
 
+/**
+ * Put a pool packet in the TX task without copying it. Ownership of the packet
+ * passes to the CRTP stack, also when the TX queue is full.
+ *
+ * @param[in] p Packet obtained from crtpPoolAllocTx()
+ */
+int crtpSendPacketRef(CRTPPacket *p);
+
 /**
  * Fetch a packet with a specidied task ID.
  *
@@ -138,6 +303,19 @@ int crtpReceivePacket(CRTPPort taskId, CRTPPacket *p);
  */
 int crtpReceivePacketWait(CRTPPort taskId, CRTPPacket *p, int wait);
 
+/**
+ * Fetch a packet with a specified task ID without copying it. The packet comes
+ * from the CRTP packet pool and the caller owns it: it must be returned with
+ * crtpPoolFree() once consumed.
+ *
+ * @param[in]  taskId The id of the CRTP task
+ * @param[out] p      Set to the received pool packet
+ * @param[in]  wait   Wait time in milisecond
+ *
+ * @returns status of fetch from queue
+ */
+int crtpReceivePacketRef(CRTPPort taskId, CRTPPacket **p, int wait);
+
 /**
  * Get the number of free tx packets in the queue
  *
@@ -158,22 +336,54 @@ int crtpReceivePacketBlock(CRTPPort taskId, CRTPPacket *p);
 /**
  * Function pointer structure to be filled by the CRTP link to permits CRTP to
  * use manu link
+ *
+ * receivePacket hands over a packet taken from the CRTP packet pool, the
+ * caller becomes its owner. sendPacket only borrows the packet and returns
+ * true once the link has accepted it. sendPacketWait is optional: it does the
+ * same but sleeps until the link signals free room, for at most 'timeout'
+ * milliseconds.
+ *
+ * isConnected tells whether the transport itself is up (USB configured, modem
+ * present), packets are only sent on connected links. isActive is optional:
+ * true while the link received something in the last CRTP_LINK_TIMEOUT_MS. It
+ * is only a routing hint and never holds back transmission.
  */
 struct crtpLinkOperations {
   int (*setEnable)(bool enable);
   int (*sendPacket)(CRTPPacket *pk);
-  int (*receivePacket)(CRTPPacket *pk);
+  int (*sendPacketWait)(CRTPPacket *pk, uint32_t timeout);
+  int (*receivePacket)(CRTPPacket **pk);
   bool (*isConnected)(void);
+  bool (*isActive)(void);
   int (*reset)(void);
 };
 
+/**
+ * Make 'lk' the only link, the primary one at index 0.
+ */
 void crtpSetLink(struct crtpLinkOperations * lk);
 
 /**
- * Check if the connection timeout has been reached, otherwise
- * we will assume that we are connected.
+ * Run 'lk' alongside the links already set, with its own receive task.
+ *
+ * @return Index of the link, -1 if all CRTP_MAX_LINKS are in use
+ */
+int crtpAddLink(struct crtpLinkOperations * lk);
+
+/**
+ * Links the packets of 'port' are sent on when they are not a reply. They go
+ * out on every connected link of 'linkMask' (CRTP_LINK_MASK), preferring those
+ * that are active. If none of them is connected they fail over to the first
+ * active link, else to the first connected one. The default is the primary
+ * link.
+ */
+void crtpSetPortRoute(CRTPPort port, uint8_t linkMask);
+
+/**
+ * Check if a link is connected, see crtpLinkOperations.isConnected. Quiet
+ * hosts do not count as lost.
  *
- * @return true if conencted, otherwise false
+ * @return true if at least one link is conencted, otherwise false
  */
 bool crtpIsConnected(void);
 
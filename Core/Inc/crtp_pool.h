@@ -0,0 +1,75 @@
+#ifndef __CRTP_POOL_H__
+#define __CRTP_POOL_H__
+
+#include <stdint.h>
+#include "crtp.h"
+
+/**
+ * Number of CRTP packets in the shared pool. Only pointers to these packets
+ * travel through the link, RX and TX queues, so this bounds the total number
+ * of packets in flight in the whole stack.
+ */
+#define CRTP_POOL_SIZE 48
+
+/**
+ * Number of packets the TX side can never take from the pool, so a burst of
+ * outgoing traffic can not starve the receive path.
+ */
+#define CRTP_POOL_RX_RESERVE 8
+
+typedef struct {
+  uint32_t allocs;      //< Successful allocations
+  uint32_t failures;    //< Allocations that found the pool empty
+  uint16_t free;        //< Packets currently free
+  uint16_t minFree;     //< Lowest number of free packets seen
+} CrtpPoolStats;
+
+/**
+ * Initialize the packet pool. Must be called before any other pool function.
+ */
+void crtpPoolInit(void);
+
+/**
+ * Take a packet from the pool. Safe to call from tasks and from interrupts.
+ *
+ * @return A packet owned by the caller, or NULL if the pool is empty
+ */
+CRTPPacket *crtpPoolAlloc(void);
+
+/**
+ * Take a packet from the pool for transmission. Same as crtpPoolAlloc() but
+ * fails while only the RX reserve is left.
+ *
+ * @return A packet owned by the caller, or NULL if no TX packet is available
+ */
+CRTPPacket *crtpPoolAllocTx(void);
+
+/**
+ * Give a packet back to the pool. Safe to call from tasks and from interrupts.
+ *
+ * @param[in] p Packet previously returned by crtpPoolAlloc(), may be NULL
+ */
+void crtpPoolFree(CRTPPacket *p);
+
+/**
+ * Record when the link received a packet, for latency tracing. Kept beside
+ * the pool rather than in CRTPPacket so the packet layout stays the wire one.
+ *
+ * @param[in] p Packet from the pool
+ * @param[in] stamp Cycle counter value, see cyclecounter.h
+ */
+void crtpPoolSetTimestamp(CRTPPacket *p, uint32_t stamp);
+
+/**
+ * @return The value set by crtpPoolSetTimestamp(), 0 if the packet was never stamped
+ */
+uint32_t crtpPoolGetTimestamp(const CRTPPacket *p);
+
+/**
+ * Get a snapshot of the pool usage counters.
+ *
+ * @param[out] stats Filled with the current counters
+ */
+void crtpPoolGetStats(CrtpPoolStats *stats);
+
+#endif //__CRTP_POOL_H__
@@ -0,0 +1,118 @@
+#ifndef __CRTPSERVICE_H__
+#define __CRTPSERVICE_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "crtp.h"
+#include "latency.h"
+
+/**
+ * Link service on CRTP_PORT_LINK.
+ *
+ * The echo channel sends every packet back unchanged and the sink channel
+ * drops them, for round trip and throughput measurements. The stats channel
+ * answers queries whose first data byte is a CrtpSrvStatsCommand. All
+ * multi-byte fields are little endian.
+ */
+typedef enum {
+  CRTP_SRV_LINK_ECHO  = 0x00,
+  CRTP_SRV_LINK_STATS = 0x01,
+  CRTP_SRV_LINK_SINK  = 0x02,
+} CrtpSrvChannel;
+
+typedef enum {
+  /**
+   * [cmd, id] -> one CrtpSrvHistogramSummary followed by
+   * CrtpSrvHistogramBins packets covering all HISTOGRAM_BINS bins
+   */
+  CRTP_SRV_STATS_HISTOGRAM       = 0x01,
+  CRTP_SRV_STATS_HISTOGRAM_BINS  = 0x02,
+  /** [cmd, id] -> [cmd, id] once cleared */
+  CRTP_SRV_STATS_HISTOGRAM_RESET = 0x03,
+  /** [cmd, port] -> CrtpSrvPortStats */
+  CRTP_SRV_STATS_PORT            = 0x04,
+  /** [cmd] -> CrtpSrvLinkStats */
+  CRTP_SRV_STATS_LINK            = 0x05,
+  /** [cmd, host data...] -> CrtpSrvPing, the host data copied back */
+  CRTP_SRV_STATS_PING            = 0x06,
+  /** [cmd, samples (u16)] -> CrtpSrvMotorBench, the motors keep their output */
+  CRTP_SRV_STATS_MOTOR_BENCH     = 0x07,
+} CrtpSrvStatsCommand;
+
+/**
+ * Histograms that can be queried. The first ones are the latency stages,
+ * all values are in us.
+ */
+typedef enum {
+  CRTP_SRV_HIST_CONTROLLER_JITTER = LATENCY_STAGE_COUNT,  //< Control period deviation
+  CRTP_SRV_HIST_CONTROLLER_EXEC,                          //< Control loop execution time
+  CRTP_SRV_HIST_COUNT,
+} CrtpSrvHistogram;
+
+#define CRTP_SRV_BINS_PER_PACKET 6
+
+typedef struct {
+  uint8_t command;      //< CRTP_SRV_STATS_HISTOGRAM
+  uint8_t id;
+  uint32_t binWidth;
+  uint32_t count;
+  uint32_t min;         //< UINT32_MAX while count is 0
+  uint32_t max;
+  uint32_t mean;
+} __attribute__((packed)) CrtpSrvHistogramSummary;
+
+typedef struct {
+  uint8_t command;      //< CRTP_SRV_STATS_HISTOGRAM_BINS
+  uint8_t id;
+  uint8_t first;        //< Index of bins[0], the packet holds up to CRTP_SRV_BINS_PER_PACKET
+  uint32_t bins[CRTP_SRV_BINS_PER_PACKET];
+} __attribute__((packed)) CrtpSrvHistogramBins;
+
+typedef struct {
+  uint8_t command;      //< CRTP_SRV_STATS_PORT
+  uint8_t port;
+  uint32_t rxPackets;
+  uint32_t rxBytes;
+  uint32_t rxDropped;
+  uint32_t txPackets;
+  uint32_t txBytes;
+  uint32_t txDropped;
+  uint16_t rxHighWater;
+} __attribute__((packed)) CrtpSrvPortStats;
+
+typedef struct {
+  uint8_t command;                            //< CRTP_SRV_STATS_LINK
+  uint16_t txHighWater[CRTP_TX_LANE_COUNT];   //< Per TX lane
+  uint16_t deliveryHighWater;                 //< Link to crtpRxTask queue
+  uint16_t poolMinFree;
+  uint32_t linkRetries;                       //< TX task attempts refused by the link
+  uint32_t linkWaits;                         //< Waits for a USB transfer to complete
+  uint32_t usbRxDropped;
+  uint32_t usbRxErrors;
+} __attribute__((packed)) CrtpSrvLinkStats;
+
+#define CRTP_SRV_PING_DATA_SIZE (CRTP_MAX_DATA_SIZE - 9)
+
+typedef struct {
+  uint8_t command;      //< CRTP_SRV_STATS_PING
+  uint32_t tick;        //< Kernel tick when answered, in ms
+  uint32_t cycles;      //< Cycle counter when answered
+  uint8_t data[CRTP_SRV_PING_DATA_SIZE];
+} __attribute__((packed)) CrtpSrvPing;
+
+typedef struct {
+  uint8_t command;                //< CRTP_SRV_STATS_MOTOR_BENCH
+  uint32_t samples;
+  uint32_t floatCycles;           //< Float reference mixer, all samples
+  uint32_t fixedCycles;           //< Integer mixer of carSet, all samples
+  uint32_t commandMismatches;
+  uint32_t saturationMismatches;
+  uint32_t compareMismatches;
+  uint16_t maxCommandError;
+} __attribute__((packed)) CrtpSrvMotorBench;
+
+void crtpserviceInit(void);
+
+bool crtpserviceTest(void);
+
+#endif //__CRTPSERVICE_H__
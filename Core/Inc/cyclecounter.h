@@ -0,0 +1,19 @@
+#ifndef __CYCLECOUNTER_H__
+#define __CYCLECOUNTER_H__
+
+#include <stdint.h>
+
+/**
+ * Free running CPU cycle counter (DWT CYCCNT), used for timing measurements.
+ * It wraps after 2^32 cycles (about 25 s at 168 MHz), differences of two
+ * readings are valid as long as they are taken closer than that.
+ */
+void cycleCounterInit(void);
+
+uint32_t cycleCounterGet(void);
+
+uint32_t cycleCounterToUs(uint32_t cycles);
+
+uint32_t cycleCounterFromUs(uint32_t us);
+
+#endif //__CYCLECOUNTER_H__
@@ -0,0 +1,70 @@
+#ifndef __DEFERLOG_H__
+#define __DEFERLOG_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "debug.h"
+
+/**
+ * Deferred logging.
+ *
+ * DEBUG_PRINT_DEFER() only stores the format string pointer and the raw
+ * argument words in a ring, which takes a few cycles and never blocks. It is
+ * safe on hot paths and in interrupts. A low priority task formats the
+ * entries later and prints them on the debug UART.
+ *
+ * Restrictions compared to DEBUG_PRINT_UART():
+ * - at most DEFERLOG_MAX_ARGS arguments, each stored in a pointer sized word,
+ *   integers and floats in its low 32 bits (no %ll)
+ * - the format string and %s arguments must stay valid, e.g. literals
+ */
+
+#define DEFERLOG_MAX_ARGS 6
+
+typedef struct {
+  uint32_t written;   //< Entries recorded
+  uint32_t dropped;   //< Entries lost because the ring was full
+} DeferlogStats;
+
+void deferlogInit(void);
+bool deferlogTest(void);
+
+/**
+ * Record one entry. Use DEBUG_PRINT_DEFER() instead of calling this directly.
+ */
+void deferlogWrite(const char *fmt, uint32_t nargs, const uintptr_t *args);
+
+void deferlogGetStats(DeferlogStats *stats);
+
+static inline uintptr_t deferlogInt(uint32_t v) { return v; }
+static inline uintptr_t deferlogStr(const char *s) { return (uintptr_t)s; }
+static inline uintptr_t deferlogFloat(float f) { union { float f; uint32_t u; } v = { .f = f }; return v.u; }
+
+#define DEFERLOG_ARG(X) _Generic((X), \
+    float: deferlogFloat, double: deferlogFloat, \
+    char *: deferlogStr, const char *: deferlogStr, \
+    default: deferlogInt)(X)
+
+#define DEFERLOG_NARGS(...) DEFERLOG_NARGS_(0, ## __VA_ARGS__, 6, 5, 4, 3, 2, 1, 0)
+#define DEFERLOG_NARGS_(_0, _1, _2, _3, _4, _5, _6, N, ...) N
+
+#define DEFERLOG_A0()
+#define DEFERLOG_A1(a) DEFERLOG_ARG(a)
+#define DEFERLOG_A2(a, b) DEFERLOG_A1(a), DEFERLOG_ARG(b)
+#define DEFERLOG_A3(a, b, c) DEFERLOG_A2(a, b), DEFERLOG_ARG(c)
+#define DEFERLOG_A4(a, b, c, d) DEFERLOG_A3(a, b, c), DEFERLOG_ARG(d)
+#define DEFERLOG_A5(a, b, c, d, e) DEFERLOG_A4(a, b, c, d), DEFERLOG_ARG(e)
+#define DEFERLOG_A6(a, b, c, d, e, f) DEFERLOG_A5(a, b, c, d, e), DEFERLOG_ARG(f)
+#define DEFERLOG_CAT(A, B) DEFERLOG_CAT_(A, B)
+#define DEFERLOG_CAT_(A, B) A ## B
+#define DEFERLOG_ARGS(...) DEFERLOG_CAT(DEFERLOG_A, DEFERLOG_NARGS(__VA_ARGS__))(__VA_ARGS__)
+
+/* The dead eprintf() call only lets the compiler check the format */
+#define DEBUG_PRINT_DEFER(FMT, ...) do { \
+    const uintptr_t deferlogArgs_[DEFERLOG_MAX_ARGS] = { DEFERLOG_ARGS(__VA_ARGS__) }; \
+    deferlogWrite(DEBUG_FMT(FMT), DEFERLOG_NARGS(__VA_ARGS__), deferlogArgs_); \
+    if (0) eprintf(0, FMT, ## __VA_ARGS__); \
+  } while (0)
+
+#endif //__DEFERLOG_H__
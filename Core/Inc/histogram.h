@@ -0,0 +1,27 @@
+#ifndef __HISTOGRAM_H__
+#define __HISTOGRAM_H__
+
+#include <stdint.h>
+
+#define HISTOGRAM_BINS 16
+
+/**
+ * Linear histogram with fixed width bins. Values beyond the last bin are
+ * counted in it, so the last bin reads as "this much or more".
+ */
+typedef struct {
+  uint32_t binWidth;
+  uint32_t count;
+  uint32_t min;
+  uint32_t max;
+  uint64_t sum;
+  uint32_t bins[HISTOGRAM_BINS];
+} Histogram;
+
+void histogramInit(Histogram *h, uint32_t binWidth);
+
+void histogramAdd(Histogram *h, uint32_t value);
+
+uint32_t histogramMean(const Histogram *h);
+
+#endif //__HISTOGRAM_H__
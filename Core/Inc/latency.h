@@ -0,0 +1,37 @@
+#ifndef __LATENCY_H__
+#define __LATENCY_H__
+
+#include <stdint.h>
+#include "histogram.h"
+
+/**
+ * Stages of the setpoint path, from the USB interrupt to the motor timers.
+ * Each stage is timed from the end of the previous one, LATENCY_TOTAL covers
+ * the whole path.
+ */
+typedef enum {
+  LATENCY_USB_TO_DISPATCH = 0,      //< CDC_Receive_FS to crtpRxTask dispatch
+  LATENCY_DISPATCH_TO_CONTROLLER,   //< Dispatch to controllerTask picking the setpoint up
+  LATENCY_CONTROLLER_TO_PWM,        //< Pick up to the last compare register write
+  LATENCY_TOTAL,                    //< CDC_Receive_FS to the last compare register write
+  LATENCY_STAGE_COUNT,
+} LatencyStage;
+
+void latencyInit(void);
+
+/**
+ * Add one sample to a stage histogram. Safe from tasks and interrupts.
+ *
+ * @param[in] from Cycle counter value at the start of the stage, 0 if unknown
+ * @param[in] to Cycle counter value at the end of the stage
+ */
+void latencyRecord(LatencyStage stage, uint32_t from, uint32_t to);
+
+/**
+ * Copy a stage histogram, in us.
+ */
+void latencyGet(LatencyStage stage, Histogram *h);
+
+void latencyReset(LatencyStage stage);
+
+#endif //__LATENCY_H__
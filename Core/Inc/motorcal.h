@@ -0,0 +1,78 @@
+#ifndef __MOTORCAL_H__
+#define __MOTORCAL_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "car_driver.h"
+
+/**
+ * Motor calibration on CRTP_PORT_MEM, channel 0.
+ *
+ * The tables of the motor output path (MotorLut, one per motor and direction)
+ * can be read and written, so the host keeps them in a file and loads them
+ * again after a reset. They can also be measured. A sweep steps the raw
+ * output of one motor from 0 to full scale. At every step the car sends a
+ * MotorcalSample and waits for the host to send it back with the measured
+ * response, e.g. the wheel speed. The car has no speed sensor of its own. The
+ * table that makes the response linear in the command then replaces the one
+ * of the motor. Any setpoint or stop for the controller, including the
+ * timeout of the last setpoint, aborts a sweep with MOTORCAL_ERROR_ABORTED.
+ *
+ * Every command is answered with [command, MotorcalStatus, ...]. Fields are
+ * little endian.
+ */
+typedef enum {
+  MOTORCAL_CMD_READ   = 0x01,   //< MotorcalChunk without points -> MotorcalChunk
+  MOTORCAL_CMD_WRITE  = 0x02,   //< MotorcalChunk, into the edit buffer of that table
+  MOTORCAL_CMD_APPLY  = 0x03,   //< [cmd, motor, direction], the edit buffer to the motor
+  MOTORCAL_CMD_RESET  = 0x04,   //< [cmd], default tables on all motors
+  MOTORCAL_CMD_SWEEP  = 0x05,   //< MotorcalSweep, answered when done
+  MOTORCAL_CMD_SAMPLE = 0x06,   //< MotorcalSample, from the car during a sweep and back
+  MOTORCAL_CMD_ABORT  = 0x07,   //< [cmd], ends a sweep
+} MotorcalCommand;
+
+typedef enum {
+  MOTORCAL_OK = 0,
+  MOTORCAL_ERROR_LENGTH,
+  MOTORCAL_ERROR_INDEX,         //< No such motor, direction or point
+  MOTORCAL_ERROR_TABLE,         //< Points decrease or exceed the command range
+  MOTORCAL_ERROR_BUSY,          //< A sweep is running
+  MOTORCAL_ERROR_TIMEOUT,       //< No response from the host, or the link was lost
+  MOTORCAL_ERROR_RESPONSE,      //< The response did not rise with the output
+  MOTORCAL_ERROR_ABORTED,
+  MOTORCAL_ERROR_COMMAND,
+} MotorcalStatus;
+
+#define MOTORCAL_CHUNK_POINTS 12
+#define MOTORCAL_SWEEP_MAX_STEPS 33
+#define MOTORCAL_RESPONSE_TIMEOUT_MS 60000
+
+typedef struct {
+  uint8_t command;      //< MOTORCAL_CMD_READ or MOTORCAL_CMD_WRITE
+  uint8_t status;       //< MotorcalStatus in answers, ignored in requests
+  uint8_t motor;
+  uint8_t direction;    //< 0 forward, 1 backward
+  uint8_t first;        //< Index of points[0]
+  uint16_t points[MOTORCAL_CHUNK_POINTS];   //< As many as the packet holds
+} __attribute__((packed)) MotorcalChunk;
+
+typedef struct {
+  uint8_t command;      //< MOTORCAL_CMD_SWEEP
+  uint8_t motor;
+  uint8_t direction;
+  uint8_t steps;        //< Outputs from 0 to full scale, 3 to MOTORCAL_SWEEP_MAX_STEPS
+  uint16_t settle;      //< ms at each output before the response is taken
+} __attribute__((packed)) MotorcalSweep;
+
+typedef struct {
+  uint8_t command;      //< MOTORCAL_CMD_SAMPLE
+  uint8_t status;
+  uint8_t step;
+  uint16_t output;      //< Raw output, in command units
+  int32_t response;     //< Filled in by the host, any unit that grows with speed
+} __attribute__((packed)) MotorcalSample;
+
+void motorcalInit(void);
+bool motorcalTest(void);
+
+#endif //__MOTORCAL_H__
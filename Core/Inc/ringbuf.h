@@ -0,0 +1,69 @@
+#ifndef __RINGBUF_H__
+#define __RINGBUF_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * Single producer, single consumer lock-free byte ring.
+ *
+ * The producer only writes 'head' and the consumer only writes 'tail', so one
+ * side may run in an interrupt and the other in a task without any lock or
+ * kernel call. The size must be a power of two.
+ */
+typedef struct {
+  uint8_t *buffer;
+  uint32_t mask;
+  uint32_t head;    //< Free running write index, owned by the producer
+  uint32_t tail;    //< Free running read index, owned by the consumer
+} RingBuffer;
+
+/**
+ * Declare the storage and the ring in one go.
+ *
+ * @param NAME Name of the RingBuffer variable
+ * @param SIZE Size in bytes, must be a power of two
+ */
+#define RINGBUF_ALLOC(NAME, SIZE) \
+  static uint8_t NAME ## Storage[(SIZE)]; \
+  static RingBuffer NAME = { .buffer = NAME ## Storage, .mask = (SIZE) - 1 };
+
+void ringBufferInit(RingBuffer *rb, uint8_t *buffer, uint32_t size);
+
+/**
+ * @return Number of bytes that can be read
+ */
+uint32_t ringBufferUsed(const RingBuffer *rb);
+
+/**
+ * @return Number of bytes that can be written
+ */
+uint32_t ringBufferFree(const RingBuffer *rb);
+
+/**
+ * Producer side. Writes all of 'data' or nothing.
+ *
+ * @return true if the data was written, false if there was not enough room
+ */
+bool ringBufferWrite(RingBuffer *rb, const uint8_t *data, uint32_t len);
+
+/**
+ * Consumer side. Reads up to 'len' bytes.
+ *
+ * @return Number of bytes read
+ */
+uint32_t ringBufferRead(RingBuffer *rb, uint8_t *data, uint32_t len);
+
+/**
+ * Consumer side. Copies up to 'len' bytes without consuming them.
+ *
+ * @return Number of bytes copied
+ */
+uint32_t ringBufferPeek(const RingBuffer *rb, uint8_t *data, uint32_t len);
+
+/**
+ * Consumer side. Drops 'len' bytes, which must not exceed ringBufferUsed().
+ */
+void ringBufferSkip(RingBuffer *rb, uint32_t len);
+
+#endif //__RINGBUF_H__
@@ -0,0 +1,110 @@
+#ifndef __SERIALLINK_H__
+#define __SERIALLINK_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "cmsis_os2.h"
+#include "crtp.h"
+#include "ringbuf.h"
+#include "syslink.h"
+
+/*
+ * The part of a CRTP link over a syslink byte stream that does not depend on
+ * the transport, shared by usblink and uartlink.
+ *
+ * Reception: the transport interrupt writes the received bytes into 'rxRing'
+ * and records their arrival with seriallinkStampFromISR(). The link task
+ * calls seriallinkReceive(), which parses the ring and hands every CRTP
+ * packet to the fast path or to the 'delivery' queue, stamped with the
+ * arrival of its last byte.
+ *
+ * Transmission: packets are encoded into one of two buffers while the other
+ * one is being sent, and a whole buffer goes out in one transfer through the
+ * 'transmit' hook. The transport calls seriallinkTxDoneFromISR() when a
+ * transfer has completed.
+ */
+
+#define SERIALLINK_RX_STAMPS 16
+
+typedef struct {
+  uint32_t end;     //< rxRing head after the transfer
+  uint32_t stamp;   //< Cycle counter when the transfer was received
+} SerialLinkStamp;
+
+typedef struct {
+  /* Set up by the transport */
+  RingBuffer *rxRing;
+  /**
+   * Start one transfer of 'len' bytes. Called with the transport interrupt
+   * masked, never while a transfer is in flight.
+   * @return true if the transfer was started
+   */
+  bool (*transmit)(uint8_t *data, uint32_t len);
+  /** Called by seriallinkReceive() each time it has made room in rxRing, may be NULL */
+  void (*rxDrained)(void);
+  uint8_t *txBuffer[2];
+  uint32_t txBufferSize;
+
+  /* Set by seriallinkInit() */
+  osMessageQueueId_t delivery;
+  osSemaphoreId_t txDone;   //< Released by every completed transfer
+
+  SyslinkParser rxParser;
+  SerialLinkStamp rxStamps[SERIALLINK_RX_STAMPS];
+  uint32_t rxStampHead;     //< Written by the interrupt only
+  uint32_t rxStampTail;     //< Written by the link task only
+  uint32_t rxParsed;        //< Bytes taken from rxRing, free running like its indexes
+  uint32_t rxLastStamp;
+  volatile uint32_t lastRxTick;
+  volatile bool rxSeen;
+  uint16_t rxHighWater;
+
+  int txFillIndex;
+  uint32_t txFill;
+  bool txBusy;
+  uint32_t txPackets;
+  uint32_t txTransfers;
+  uint32_t txWaits;
+} SerialLink;
+
+void seriallinkInit(SerialLink *sl, osMessageQueueId_t delivery, osSemaphoreId_t txDone);
+
+/**
+ * Record the arrival of the bytes just written into rxRing. Called by the
+ * transport interrupt, after each write.
+ */
+void seriallinkStampFromISR(SerialLink *sl, uint32_t stamp);
+
+/**
+ * Parse whatever rxRing holds and deliver the packets. Called by the link
+ * task, it may block while the CRTP pool or the delivery queue is full.
+ */
+void seriallinkReceive(SerialLink *sl);
+
+/**
+ * Append one packet to the pending transfer and start it if the transport is
+ * idle. Safe from tasks.
+ * @return false only when both buffers are full
+ */
+bool seriallinkSendPacket(SerialLink *sl, const CRTPPacket *p);
+
+/** Same as seriallinkSendPacket(), waiting up to 'timeout' ticks for room */
+bool seriallinkSendPacketWait(SerialLink *sl, const CRTPPacket *p, uint32_t timeout);
+
+/** The transfer in flight has completed, start the next one */
+void seriallinkTxDoneFromISR(SerialLink *sl);
+
+/**
+ * The transfer in flight will never complete, e.g. the transport was reset.
+ * Nothing is started from here, seriallinkTxFlush() does it.
+ */
+void seriallinkTxResetFromISR(SerialLink *sl);
+
+/** Start a transfer with what is pending, from a task */
+void seriallinkTxFlush(SerialLink *sl);
+
+/** A packet was received in the last CRTP_LINK_TIMEOUT_MS */
+bool seriallinkIsActive(const SerialLink *sl);
+
+#endif //__SERIALLINK_H__
@@ -0,0 +1,58 @@
+#ifndef __SETPOINT_GENERIC_H__
+#define __SETPOINT_GENERIC_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * Compact setpoints on CRTP_PORT_SETPOINT_GENERIC, channel 0.
+ *
+ * The first data byte is a SetpointGenericType, which also fixes the layout:
+ * a changed layout gets a new type, the old one keeps working. Roll, pitch and
+ * yaw are Q15 ratios in [-1, 1), thrust is unsigned as in setpoint_t. All
+ * fields are little endian. Packets whose length does not match their type are
+ * dropped.
+ *
+ * Immediate setpoints (RATIO_Q15, or CRTP_PORT_SETPOINT) cancel what is left of
+ * a TIMED_Q15 schedule, so a host going back from batched to immediate
+ * commands is not overridden by stale entries.
+ */
+typedef enum {
+  SETPOINT_GENERIC_STOP      = 0x00,  //< [type], stop the motors and drop the schedule
+  SETPOINT_GENERIC_RATIO_Q15 = 0x01,  //< SetpointGenericRatio, applied on reception, drops the schedule
+  SETPOINT_GENERIC_TIMED_Q15 = 0x02,  //< SetpointGenericTimed, replaces the schedule
+  SETPOINT_GENERIC_TYPE_COUNT,
+} SetpointGenericType;
+
+typedef struct {
+  uint8_t type;         //< SETPOINT_GENERIC_RATIO_Q15
+  int16_t roll;
+  int16_t pitch;
+  int16_t yaw;
+  uint16_t thrust;
+} __attribute__((packed)) SetpointGenericRatio;
+
+typedef struct {
+  uint16_t offset;      //< Due time in ms after reception, increasing along the packet
+  int16_t roll;
+  int16_t pitch;
+  int16_t yaw;
+} __attribute__((packed)) SetpointGenericTimedEntry;
+
+#define SETPOINT_GENERIC_TIMED_MAX 3
+
+typedef struct {
+  uint8_t type;         //< SETPOINT_GENERIC_TIMED_Q15
+  uint16_t thrust;      //< Shared by all entries
+  SetpointGenericTimedEntry entries[SETPOINT_GENERIC_TIMED_MAX];  //< 1 to SETPOINT_GENERIC_TIMED_MAX
+} __attribute__((packed)) SetpointGenericTimed;
+
+void setpointGenericInit(void);
+bool setpointGenericTest(void);
+
+/**
+ * @return Number of packets dropped for an unknown type or a bad length
+ */
+uint32_t setpointGenericGetRejected(void);
+
+#endif //__SETPOINT_GENERIC_H__
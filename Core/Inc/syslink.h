@@ -0,0 +1,89 @@
+#ifndef __SYSLINK_H__
+#define __SYSLINK_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * Byte stream framing shared by the serial links (USB CDC, UART).
+ *
+ * A frame is: START1 START2 TYPE LENGTH DATA[LENGTH] CK0 CK1, where CK0/CK1 is
+ * an 8-bit Fletcher checksum over TYPE, LENGTH and DATA. Frames may be split
+ * over or packed into transfers in any way, the parser only sees bytes.
+ */
+
+#define SYSLINK_MTU 32
+
+#define SYSLINK_START_BYTE1 0xBC
+#define SYSLINK_START_BYTE2 0xCF
+
+/*! Start bytes, type, length and the two checksum bytes */
+#define SYSLINK_FRAME_OVERHEAD 6
+#define SYSLINK_FRAME_SIZE(LENGTH) ((LENGTH) + SYSLINK_FRAME_OVERHEAD)
+
+// Defined packet types
+#define SYSLINK_RADIO_RAW      0x00   //< Payload is a raw CRTP packet (header + data)
+//#define SYSLINK_RADIO_CHANNEL  0x01
+//#define SYSLINK_RADIO_DATARATE 0x02
+
+//#define SYSLINK_PM_SOURCE 0x10
+
+//#define SYSLINK_PM_ONOFF_SWITCHOFF 0x11
+
+//#define SYSLINK_PM_BATTERY_VOLTAGE 0x12
+//#define SYSLINK_PM_BATTERY_STATE   0x13
+//#define SYSLINK_PM_BATTERY_AUTOUPDATE 0x14
+
+//#define SYSLINK_OW_SCAN 0x20
+//#define SYSLINK_OW_READ 0x21
+
+typedef struct _SyslinkPacket {
+  uint8_t type;
+  uint8_t length;
+  uint8_t data[SYSLINK_MTU];
+} __attribute__((packed)) SyslinkPacket;
+
+typedef enum {
+  waitForFirstStart,
+  waitForSecondStart,
+  waitForType,
+  waitForLength,
+  waitForData,
+  waitForChksum1,
+  waitForChksum2
+} SyslinkRxState;
+
+typedef struct {
+  SyslinkRxState state;
+  uint8_t index;
+  uint8_t cksum[2];
+  SyslinkPacket packet;   //< Last complete packet, valid when syslinkParseByte() returns true
+  uint32_t errors;        //< Frames dropped for bad length or checksum
+} SyslinkParser;
+
+void syslinkParserInit(SyslinkParser *ps);
+
+/**
+ * Feed one byte to the incremental parser.
+ *
+ * @param[in] ps Parser state
+ * @param[in] c  Next byte of the stream
+ *
+ * @return true when 'c' completed a valid frame, available in ps->packet
+ */
+bool syslinkParseByte(SyslinkParser *ps, uint8_t c);
+
+/**
+ * Write one frame.
+ *
+ * @param[out] buf    Destination buffer
+ * @param[in]  size   Room left in buf
+ * @param[in]  type   Packet type
+ * @param[in]  data   Payload
+ * @param[in]  length Payload length, at most SYSLINK_MTU
+ *
+ * @return Number of bytes written, or 0 if the frame does not fit
+ */
+int syslinkEncode(uint8_t *buf, int size, uint8_t type, const uint8_t *data, uint8_t length);
+
+#endif //__SYSLINK_H__
@@ -44,6 +44,7 @@ void MX_TIM2_Init(void);
 void HAL_TIM_MspPostInit(TIM_HandleTypeDef *htim);
 
 /* USER CODE BEGIN Prototypes */
+uint32_t timGetClockFreq(TIM_HandleTypeDef *htim);
 
 /* USER CODE END Prototypes */
 
@@ -0,0 +1,97 @@
+#ifndef __TRAJECTORY_H__
+#define __TRAJECTORY_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "car_driver.h"
+
+/**
+ * Trajectory executor on CRTP_PORT_SETPOINT_HL, channel 0.
+ *
+ * The host uploads segments into numbered slots, then starts a queue of them.
+ * The control loop evaluates the running segment every period, so the car
+ * follows the plan whatever the link timing. A segment gives roll, pitch and
+ * yaw as cubic polynomials of the normalised time s = t / duration in [0, 1],
+ * and a constant thrust. There is no position feedback on the car, so the
+ * plan is in setpoint space: a go-to ramps smoothly to a target setpoint.
+ *
+ * When the queue runs out the last value is held until TRAJECTORY_CMD_STOP,
+ * a new plan, a low level setpoint or the loss of the link. Only the link
+ * itself going down counts as a loss (USB unplugged or unconfigured, modem
+ * DTR released, see crtpIsConnected()). The host may stay silent for the
+ * whole plan, there is no heartbeat. Every command is answered with
+ * [command, TrajectoryStatus]. Fields are little endian.
+ */
+typedef enum {
+  TRAJECTORY_CMD_POLY   = 0x01,   //< TrajectoryPolyUpload
+  TRAJECTORY_CMD_HOLD   = 0x02,   //< TrajectoryHoldUpload
+  TRAJECTORY_CMD_START  = 0x03,   //< [cmd, first, count], count 0 runs the appended queue
+  TRAJECTORY_CMD_APPEND = 0x04,   //< [cmd, index], queued after the current plan
+  TRAJECTORY_CMD_STOP   = 0x05,   //< [cmd]
+  TRAJECTORY_CMD_GOTO   = 0x06,   //< TrajectoryGoto, replaces the plan
+} TrajectoryCommand;
+
+typedef enum {
+  TRAJECTORY_OK = 0,
+  TRAJECTORY_ERROR_LENGTH,
+  TRAJECTORY_ERROR_INDEX,         //< No such slot, or an empty one
+  TRAJECTORY_ERROR_FULL,          //< The queue has no room left
+  TRAJECTORY_ERROR_EMPTY,         //< Nothing to start
+  TRAJECTORY_ERROR_COMMAND,
+} TrajectoryStatus;
+
+#define TRAJECTORY_SEGMENTS 16
+#define TRAJECTORY_QUEUE_SIZE 16
+/*! Polynomial coefficients are Q12, in [-8, 8) */
+#define TRAJECTORY_COEFF_SCALE 4096.0f
+
+typedef struct {
+  uint8_t command;        //< TRAJECTORY_CMD_POLY
+  uint8_t index;
+  uint16_t duration;      //< ms
+  uint16_t thrust;
+  int16_t coeff[3][4];    //< roll, pitch, yaw; c0 + c1 s + c2 s^2 + c3 s^3
+} __attribute__((packed)) TrajectoryPolyUpload;
+
+/** Constant setpoint for 'duration', a timed velocity segment */
+typedef struct {
+  uint8_t command;        //< TRAJECTORY_CMD_HOLD
+  uint8_t index;
+  uint16_t duration;      //< ms
+  int16_t roll;           //< Q15
+  int16_t pitch;
+  int16_t yaw;
+  uint16_t thrust;
+} __attribute__((packed)) TrajectoryHoldUpload;
+
+/**
+ * Smooth step from the current output to the target in 'duration'. The
+ * current output is what the control loop applied last (controllerGetOutput),
+ * a running plan or a low level setpoint alike, and zero when stopped.
+ */
+typedef struct {
+  uint8_t command;        //< TRAJECTORY_CMD_GOTO
+  uint16_t duration;      //< ms
+  int16_t roll;           //< Q15
+  int16_t pitch;
+  int16_t yaw;
+  uint16_t thrust;
+} __attribute__((packed)) TrajectoryGoto;
+
+void trajectoryInit(void);
+bool trajectoryTest(void);
+
+/**
+ * Called by the control loop every period.
+ *
+ * @param[out] sp Setpoint of the plan at 'tick', valid when true is returned
+ * @return true while a plan is running
+ */
+bool trajectoryUpdate(uint32_t tick, setpoint_t *sp);
+
+/**
+ * Drop the plan. Safe from tasks and interrupts.
+ */
+void trajectoryStop(void);
+
+#endif //__TRAJECTORY_H__
@@ -0,0 +1,33 @@
+#ifndef __UARTLINK_H__
+#define __UARTLINK_H__
+
+#include <stdbool.h>
+#include "crtp.h"
+#include "syslink.h"
+
+/*
+ * CRTP over uartlinkUart (USART2), with the same syslink framing as the USB
+ * link so a radio modem can be attached instead of the host. Reception runs
+ * a circular DMA and is only interrupted on idle line and half/full buffer,
+ * transmission sends whole batches of frames by DMA. Select it with
+ * CRTP_LINK_UART in config.h, it then runs next to the USB link and USART2 no
+ * longer prints debug output.
+ */
+
+void uartlinkInit();
+bool uartlinkTest();
+
+typedef struct {
+  uint32_t rxDropped;     //< Bytes that did not fit in the receive ring
+  uint32_t rxErrors;      //< Frames dropped by the parser
+  uint32_t rxLineErrors;  //< Overrun, noise or framing errors, each restarts reception
+  uint32_t txPackets;     //< CRTP packets queued for transmission
+  uint32_t txTransfers;   //< DMA transfers started, each carrying one or more packets
+  uint32_t txWaits;       //< Times a sender had to wait for a transfer to complete
+  uint16_t rxHighWater;   //< Highest number of packets waiting for crtpRxTask
+} UartlinkStats;
+
+void uartlinkGetStats(UartlinkStats *stats);
+struct crtpLinkOperations * uartlinkGetLink();
+
+#endif //__UARTLINK_H__
@@ -3,52 +3,50 @@
 
 #include <stdbool.h>
 #include "crtp.h"
+#include "syslink.h"
 
-//#define SYSLINK_MTU 32
-
-#define CRTP_START_BYTE  0xAA
-#define SYSLINK_START_BYTE1 0xBC
-#define SYSLINK_START_BYTE2 0xCF
-
-// Defined packet types
-//#define SYSLINK_RADIO_RAW      0x00
-//#define SYSLINK_RADIO_CHANNEL  0x01
-//#define SYSLINK_RADIO_DATARATE 0x02
-
-
-//#define SYSLINK_PM_SOURCE 0x10
-
-//#define SYSLINK_PM_ONOFF_SWITCHOFF 0x11
-
-//#define SYSLINK_PM_BATTERY_VOLTAGE 0x12
-//#define SYSLINK_PM_BATTERY_STATE   0x13
-//#define SYSLINK_PM_BATTERY_AUTOUPDATE 0x14
-
-//#define SYSLINK_OW_SCAN 0x20
-//#define SYSLINK_OW_READ 0x21
 /*
-typedef struct _SyslinkPacket
-{
-  uint8_t type;
-  uint8_t length;
-  char data[SYSLINK_MTU];
-} __attribute__((packed)) SyslinkPacket;
-
-typedef enum
-{
-  waitForFirstStart,
-  waitForSecondStart,
-  waitForType,
-  waitForLengt,
-  waitForData,
-  waitForChksum1,
-  waitForChksum2
-} SyslinkRxState;
-*/
+ * USB CDC carries a byte stream of syslink frames (see syslink.h), each
+ * SYSLINK_RADIO_RAW frame holding one CRTP packet. The host may pack several
+ * frames into one transfer or split a frame over two.
+ */
 
 void usblinkInit();
 bool usblinkTest();
-void usblinkMessagePut(CRTPPacket *p);
+
+/**
+ * Hand the bytes of one USB OUT transfer to the link. Called from the USB
+ * interrupt, it only copies into a lock-free ring and never blocks.
+ *
+ * @return true if the endpoint can be armed for the next transfer, false if
+ *         the link will resume reception itself once it has made room
+ */
+bool usblinkReceiveFromISR(const uint8_t *data, uint32_t len);
+
+/**
+ * Called from the USB interrupt when an IN transfer has completed. Starts the
+ * next transfer with everything queued in the meantime.
+ */
+void usblinkTxDoneFromISR(void);
+
+/**
+ * Called from the USB interrupt when the CDC class is (re)initialised. A
+ * transfer in flight will never complete, so it is forgotten. Nothing is sent
+ * from here, the class state is only reset once this returns: usblinkTask
+ * starts the next transfer.
+ */
+void usblinkTxResetFromISR(void);
+
+typedef struct {
+  uint32_t rxDropped;     //< USB OUT transfers that did not fit in the receive ring
+  uint32_t rxErrors;      //< Frames dropped by the parser
+  uint32_t txPackets;     //< CRTP packets queued for transmission
+  uint32_t txTransfers;   //< USB IN transfers started, each carrying one or more packets
+  uint32_t txWaits;       //< Times a sender had to wait for a transfer to complete
+  uint16_t rxHighWater;   //< Highest number of packets waiting for crtpRxTask
+} UsblinkStats;
+
+void usblinkGetStats(UsblinkStats *stats);
 struct crtpLinkOperations * usblinkGetLink();
 
 #endif //__USBLINK_H__
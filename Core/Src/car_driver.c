@@ -1,6 +1,10 @@
 #include "car_driver.h"
 #include "config.h"
 #include "tim.h"
+#include "FreeRTOS.h"
+#include "task.h"
+#include "cyclecounter.h"
+#include "cfassert.h"
 
 typedef struct {
 	// 0: forward control, 1: backward control
@@ -8,7 +12,41 @@ typedef struct {
 	uint32_t channel[2];
 } MotorTim;
 
-static int thrustBase = 18000;
+/*! Largest command, -MOTOR_MAX_THRUST would not survive the negation in int16 */
+#define MOTOR_THRUST_LIMIT (MOTOR_MAX_THRUST - 1)
+/*! Largest Q15 ratio that keeps the mix within 64 bits, larger ratios are all scaled down together */
+#define CAR_RATIO_LIMIT 1024.0f
+/*! Halvings that bring any finite float within CAR_RATIO_LIMIT */
+#define CAR_RATIO_SHIFT_MAX 118
+/*! CarMixerTable coefficients are Q14 */
+#define CAR_MIXER_LIMIT ((float)INT16_MAX / (1 << 14))
+#define CAR_BENCHMARK_BATCH 16
+/*! CPU cycles from the last counter check to the last compare write in motorCommit, with margin */
+#define MOTOR_COMMIT_WINDOW_CYCLES 128
+
+static uint32_t motorPeriod[MOTOR_NBR];	// Timer counts per PWM period, set by motorSetPwm
+static int16_t motorStaged[MOTOR_NBR];	// Commands waiting for motorCommit
+static MotorLut motorLut[MOTOR_NBR][2];	// Command to output, per direction
+static int motorOverrideId = -1;	// Motor driven by motorSetOverride, -1 for none
+static int16_t motorOverrideOutput;
+static bool motorOverrideAborted;	// Set by motorAbortOverride, until the override is released
+static TIM_HandleTypeDef *motorTimers[MOTOR_NBR * 2];	// Each motor timer once
+static int motorTimerCount;
+static uint32_t motorCommitGuard;	// Timer counts the commit window lasts, set by motorSetPwm
+
+typedef struct {
+	int16_t q14[MOTOR_NBR][CAR_AXIS_COUNT];
+	float coeff[MOTOR_NBR][CAR_AXIS_COUNT];	// The same values, for the float reference
+} CarMixerTable;
+
+/*!
+ * Written by carSetMixer into the table not in use, then swapped. A reader
+ * that took mixerActive is safe across one update only, the second one
+ * rewrites its table. Callers changing the mixer faster than a mix lasts
+ * must serialise with the readers themselves.
+ */
+static CarMixerTable mixerTables[2];
+static CarMixerTable * volatile mixerActive = &mixerTables[0];
 
 static MotorTim motorTim[4] = {
 	{
@@ -29,86 +67,543 @@ static MotorTim motorTim[4] = {
 	},
 };
 
+static void motorAddTimer(TIM_HandleTypeDef *tim) {
+	for (int t = 0; t < motorTimerCount; t++) {
+		if (motorTimers[t] == tim)
+			return;
+	}
+	motorTimers[motorTimerCount++] = tim;
+}
+
+/*! TIM1 starts TIM2 through its trigger output, see MX_TIM2_Init */
 void motorInit() {
+	for (int i = 0; i < MOTOR_NBR; i++) {
+		motorAddTimer(motorTim[i].tim[0]);
+		motorAddTimer(motorTim[i].tim[1]);
+	}
+	motorResetLut();
+	uint32_t frequency = motorSetPwm(MOTOR_PWM_FREQUENCY, MOTOR_PWM_STEPS);
+	ASSERT(frequency != 0);
 	for (int i = 0; i < MOTOR_NBR; i++) {
 		HAL_TIM_PWM_Start(motorTim[i].tim[0], motorTim[i].channel[0]);
 		HAL_TIM_PWM_Start(motorTim[i].tim[1], motorTim[i].channel[1]);
 	}
+	carSetChassis(CAR_CHASSIS);
+}
+
+/*! Compare value for a thrust magnitude, floor(magnitude * period / MOTOR_MAX_THRUST) */
+static inline uint32_t motorCompare(uint8_t id, uint32_t magnitude) {
+	return (magnitude * motorPeriod[id]) >> MOTOR_THRUST_BITS;
+}
+
+/*! Float reference of motorCompare, kept for carBenchmark */
+static uint32_t motorCompareFloat(uint8_t id, uint32_t magnitude) {
+	float ratio = magnitude * (float)motorPeriod[id] / MOTOR_MAX_THRUST;
+	return ratio;
+}
+
+static inline uint32_t motorMagnitude(int32_t thrust) {
+	uint32_t magnitude = thrust < 0 ? -thrust : thrust;
+	return magnitude > MOTOR_THRUST_LIMIT ? MOTOR_THRUST_LIMIT : magnitude;
+}
+
+/*! Output for a command magnitude, interpolated between the two nearest points */
+static inline uint32_t motorLutApply(const MotorLut *lut, uint32_t magnitude) {
+	if (magnitude == 0)
+		return 0;
+	uint32_t pos = magnitude * (MOTOR_LUT_POINTS - 1);
+	uint32_t i = pos >> MOTOR_THRUST_BITS;
+	int32_t frac = pos & (MOTOR_MAX_THRUST - 1);
+	return lut->point[i] + (((lut->point[i + 1] - lut->point[i]) * frac) >> MOTOR_THRUST_BITS);
+}
+
+bool motorSetLut(uint8_t id, bool backward, const MotorLut *lut) {
+	if (id >= MOTOR_NBR)
+		return false;
+	for (int i = 0; i < MOTOR_LUT_POINTS; i++) {
+		if (lut->point[i] > MOTOR_THRUST_LIMIT || (i > 0 && lut->point[i] < lut->point[i - 1]))
+			return false;
+	}
+	taskENTER_CRITICAL();
+	motorLut[id][backward] = *lut;
+	taskEXIT_CRITICAL();
+	return true;
+}
+
+void motorGetLut(uint8_t id, bool backward, MotorLut *lut) {
+	ASSERT(id < MOTOR_NBR);
+	taskENTER_CRITICAL();
+	*lut = motorLut[id][backward];
+	taskEXIT_CRITICAL();
+}
+
+void motorResetLut() {
+	MotorLut lut;
+	for (int i = 0; i < MOTOR_LUT_POINTS; i++)
+		lut.point[i] = MOTOR_LUT_DEADBAND + (MOTOR_THRUST_LIMIT - MOTOR_LUT_DEADBAND) * i / (MOTOR_LUT_POINTS - 1);
+	for (int i = 0; i < MOTOR_NBR; i++) {
+		motorSetLut(i, false, &lut);
+		motorSetLut(i, true, &lut);
+	}
+}
+
+bool motorSetOverride(int id, int16_t output) {
+	bool applied = true;
+	UBaseType_t mask = taskENTER_CRITICAL_FROM_ISR();
+	if (id < 0 || id >= MOTOR_NBR) {
+		motorOverrideId = -1;
+		motorOverrideAborted = false;
+	} else if (motorOverrideAborted) {
+		applied = false;
+	} else {
+		motorOverrideId = id;
+		motorOverrideOutput = output;
+	}
+	taskEXIT_CRITICAL_FROM_ISR(mask);
+	return applied;
+}
+
+void motorAbortOverride() {
+	UBaseType_t mask = taskENTER_CRITICAL_FROM_ISR();
+	if (motorOverrideId >= 0) {
+		motorOverrideId = -1;
+		motorOverrideAborted = true;
+	}
+	taskEXIT_CRITICAL_FROM_ISR(mask);
+}
+
+bool motorIsOverrideAborted() {
+	return motorOverrideAborted;
+}
+
+void motorStage(uint8_t id, int16_t thrust) {
+	motorStaged[id] = thrust;
+}
+
+/*! Scaled here rather than in motorStage, so a new period applies to the staged commands too */
+static void motorComputeCompares(uint32_t compare[MOTOR_NBR][2]) {
+	for (int i = 0; i < MOTOR_NBR; i++) {
+		int32_t command = motorStaged[i];
+		uint32_t output;
+		bool dir;
+
+		if (motorOverrideId >= 0)
+			command = i == motorOverrideId ? motorOverrideOutput : 0;
+		dir = command < 0;
+		output = motorMagnitude(command);
+		if (motorOverrideId < 0)
+			output = motorLutApply(&motorLut[i][dir], output);
+		compare[i][!dir] = 0;
+		compare[i][dir] = motorCompare(i, output);
+	}
+}
+
+static void motorWriteCompares(const uint32_t compare[MOTOR_NBR][2]) {
+	for (int i = 0; i < MOTOR_NBR; i++) {
+		__HAL_TIM_SET_COMPARE(motorTim[i].tim[0], motorTim[i].channel[0], compare[i][0]);
+		__HAL_TIM_SET_COMPARE(motorTim[i].tim[1], motorTim[i].channel[1], compare[i][1]);
+	}
+}
+
+/*! No motor timer reaches its update event within the next motorCommitGuard counts */
+static bool motorCommitWindow() {
+	for (int t = 0; t < motorTimerCount; t++) {
+		TIM_TypeDef *tim = motorTimers[t]->Instance;
+		if (tim->ARR - tim->CNT < motorCommitGuard)
+			return false;
+	}
+	return true;
+}
+
+/**
+ * The compare registers are preloaded and only copied to the counters on an
+ * update event. The eight values are computed first, then written only when
+ * no timer is about to update: every motor takes the new command on the same
+ * next period. TIM2 starts a few clocks after TIM1, each timer is checked
+ * against its own counter. The wait is at most about twice the guard.
+ */
+void motorCommit() {
+	uint32_t compare[MOTOR_NBR][2];
+
+	/*! Not preempted, the window must not stretch past the guard */
+	taskENTER_CRITICAL();
+	motorComputeCompares(compare);
+	while (!motorCommitWindow())
+		;
+	motorWriteCompares(compare);
+	taskEXIT_CRITICAL();
 }
 
 void motorSetRatio(uint8_t id, int16_t thrust) {
-	bool dir = thrust < 0;
-	if (dir) thrust = -thrust;
+	motorStage(id, thrust);
+	motorCommit();
+}
+
+uint32_t motorSetPwm(uint32_t frequency, uint32_t steps) {
+	uint32_t clock[MOTOR_NBR * 2], prescaler[MOTOR_NBR * 2];
+	uint32_t compare[MOTOR_NBR][2];
+	uint32_t slowest = UINT32_MAX, div, guard;
+	bool running = false;
+
+	if (frequency == 0)
+		return 0;
+	for (int t = 0; t < motorTimerCount; t++) {
+		clock[t] = timGetClockFreq(motorTimers[t]);
+		if (clock[t] < slowest) slowest = clock[t];
+	}
+
+	if (steps == 0) {
+		/*! The slowest clock undivided, unless the period would not fit the auto-reload */
+		div = (slowest / frequency + MOTOR_PWM_MAX_STEPS - 1) / MOTOR_PWM_MAX_STEPS;
+		steps = div ? slowest / div / frequency : 0;
+	} else {
+		uint64_t rate = (uint64_t)frequency * steps;
+		div = (slowest + rate / 2) / rate;
+	}
+	if (div == 0 || steps < 2 || steps > MOTOR_PWM_MAX_STEPS)
+		return 0;
+	/*! The commit window in counts, rounded up, and a period long enough to find it in */
+	guard = ((uint64_t)MOTOR_COMMIT_WINDOW_CYCLES * (slowest / div) + SystemCoreClock - 1) / SystemCoreClock + 1;
+	if (guard * 2 >= steps)
+		return 0;
+
+	/*! All timers count at the same rate, their periods stay aligned */
+	for (int t = 0; t < motorTimerCount; t++) {
+		uint64_t scaled = (uint64_t)clock[t] * div;
+		if (scaled % slowest != 0 || scaled / slowest > 0x10000)
+			return 0;
+		prescaler[t] = scaled / slowest - 1;
+	}
+
+	taskENTER_CRITICAL();
+	for (int t = 0; t < motorTimerCount; t++) {
+		TIM_TypeDef *tim = motorTimers[t]->Instance;
+		running |= (tim->CR1 & TIM_CR1_CEN) != 0;
+		CLEAR_BIT(tim->CR1, TIM_CR1_CEN);
+		tim->PSC = prescaler[t];
+		tim->ARR = steps - 1;
+		tim->CNT = 0;
+	}
+	for (int i = 0; i < MOTOR_NBR; i++)
+		motorPeriod[i] = steps;
+	motorCommitGuard = guard;
+	motorComputeCompares(compare);
+	motorWriteCompares(compare);
+	/*! Loads the preloaded prescaler, period and compare values at once */
+	for (int t = 0; t < motorTimerCount; t++)
+		motorTimers[t]->Instance->EGR = TIM_EGR_UG;
+	/*! Timers in trigger mode start with their master */
+	for (int t = 0; running && t < motorTimerCount; t++) {
+		if ((motorTimers[t]->Instance->SMCR & TIM_SMCR_SMS) != TIM_SLAVEMODE_TRIGGER)
+			SET_BIT(motorTimers[t]->Instance->CR1, TIM_CR1_CEN);
+	}
+	taskEXIT_CRITICAL();
+
+	return slowest / div / steps;
+}
+
+/*! Motors 0 and 1 are on one side, 2 and 3 on the other, 0 and 3 roll the same way */
+static const CarMixer chassisMixers[CAR_CHASSIS_COUNT] = {
+	[CAR_CHASSIS_MECANUM] = {
+		{ 1.0f,  1.0f, -1.0f },
+		{ 1.0f, -1.0f, -1.0f },
+		{ 1.0f,  1.0f,  1.0f },
+		{ 1.0f, -1.0f,  1.0f },
+	},
+	[CAR_CHASSIS_SKID_STEER] = {
+		{ 1.0f, 0.0f, -1.0f },
+		{ 1.0f, 0.0f, -1.0f },
+		{ 1.0f, 0.0f,  1.0f },
+		{ 1.0f, 0.0f,  1.0f },
+	},
+	// Driven wheels on motors 0 and 2. Motors 1 and 3 always mix to 0, which
+	// motorLutApply keeps at 0 output, so they stay off
+	[CAR_CHASSIS_DIFFERENTIAL] = {
+		{ 1.0f, 0.0f, -1.0f },
+		{ 0.0f, 0.0f,  0.0f },
+		{ 1.0f, 0.0f,  1.0f },
+		{ 0.0f, 0.0f,  0.0f },
+	},
+};
+
+void carSetMixer(const CarMixer mixer) {
+	taskENTER_CRITICAL();
+	CarMixerTable *table = mixerActive == &mixerTables[0] ? &mixerTables[1] : &mixerTables[0];
+	for (int m = 0; m < MOTOR_NBR; m++) {
+		for (int a = 0; a < CAR_AXIS_COUNT; a++) {
+			float c = mixer[m][a];
+			if (c > CAR_MIXER_LIMIT) c = CAR_MIXER_LIMIT;
+			else if (!(c >= -CAR_MIXER_LIMIT)) c = -CAR_MIXER_LIMIT;
+			table->q14[m][a] = c * (1 << 14);
+			table->coeff[m][a] = table->q14[m][a] / (float)(1 << 14);
+		}
+	}
+	/*! A mix in progress keeps the table it started with */
+	mixerActive = table;
+	taskEXIT_CRITICAL();
+}
+
+void carGetMixer(CarMixer mixer) {
+	const CarMixerTable *table = mixerActive;
+	for (int m = 0; m < MOTOR_NBR; m++) {
+		for (int a = 0; a < CAR_AXIS_COUNT; a++)
+			mixer[m][a] = table->coeff[m][a];
+	}
+}
+
+void carSetChassis(CarChassis chassis) {
+	ASSERT(chassis < CAR_CHASSIS_COUNT);
+	carSetMixer(chassisMixers[chassis]);
+}
+
+/**
+ * motor = gain * sum(mixer * ratio) for all motors in one pass, ratios in
+ * Q15 and the result truncated toward zero like the float to int conversion.
+ */
+static void carMixQ15(const int32_t ratio[CAR_AXIS_COUNT], uint32_t gain, int32_t motor[MOTOR_NBR]) {
+	const CarMixerTable *table = mixerActive;
+	for (int m = 0; m < MOTOR_NBR; m++) {
+		int64_t mix = 0;
+		for (int a = 0; a < CAR_AXIS_COUNT; a++)
+			mix += (int64_t)table->q14[m][a] * ratio[a];
+		mix *= gain;
+		/*! Negative values are biased so the arithmetic shift rounds up, without a branch */
+		motor[m] = (mix + ((mix >> 63) & ((1LL << 29) - 1))) >> 29;
+	}
+}
+
+/**
+ * Same as carMixQ15 with ratios in Q(15 - shift). When the result would not
+ * fit 32 bits, all motors are scaled down together instead, so that
+ * carNormalize saturates them with the same ratios.
+ */
+static void carMixQ15Scaled(const int32_t ratio[CAR_AXIS_COUNT], uint32_t gain, int shift, int32_t motor[MOTOR_NBR]) {
+	const CarMixerTable *table = mixerActive;
+	int64_t mix[MOTOR_NBR];
+	uint64_t bits = 0;
+	int exponent = shift - 29;
+
+	for (int m = 0; m < MOTOR_NBR; m++) {
+		mix[m] = 0;
+		for (int a = 0; a < CAR_AXIS_COUNT; a++)
+			mix[m] += (int64_t)table->q14[m][a] * ratio[a];
+		mix[m] *= gain;
+		bits |= mix[m] < 0 ? -mix[m] : mix[m];
+	}
+	if (bits != 0 && 64 - __builtin_clzll(bits) + exponent > 31)
+		exponent = 31 - (64 - __builtin_clzll(bits));
+
+	for (int m = 0; m < MOTOR_NBR; m++) {
+		if (exponent >= 0)
+			motor[m] = mix[m] * ((int64_t)1 << exponent);
+		else
+			motor[m] = (mix[m] + ((mix[m] >> 63) & (((int64_t)1 << -exponent) - 1))) >> -exponent;
+	}
+}
 
-	float ratio = thrust * (float)MOTOR_TIM_PERIOD / MOTOR_MAX_THRUST;
-	__HAL_TIM_SET_COMPARE(motorTim[id].tim[!dir], motorTim[id].channel[!dir], 0);
-	__HAL_TIM_SET_COMPARE(motorTim[id].tim[dir], motorTim[id].channel[dir], ratio);
+/*! Scales all motors down together when one exceeds 'range', keeping their ratios */
+static void carNormalize(int32_t motor[MOTOR_NBR], int32_t range) {
+	int32_t peak = 0;
+	for (int m = 0; m < MOTOR_NBR; m++) {
+		int32_t value = motor[m] < 0 ? -motor[m] : motor[m];
+		if (value > peak) peak = value;
+	}
+	if (peak <= range)
+		return;
+	for (int m = 0; m < MOTOR_NBR; m++)
+		motor[m] = (int64_t)motor[m] * range / peak;
+}
+
+/*! Drives the mixer with one axis at full ratio, for the raw command helpers */
+static void carDriveAxis(CarAxis axis, int32_t v) {
+	int32_t ratio[CAR_AXIS_COUNT] = { 0 };
+	int32_t motorValue[MOTOR_NBR];
+
+	ratio[axis] = v < 0 ? -(1 << 15) : (1 << 15);
+	carMixQ15(ratio, v < 0 ? -v : v, motorValue);
+	carNormalize(motorValue, MOTOR_THRUST_LIMIT);
+	for (int i = 0; i < MOTOR_NBR; i++)
+		motorStage(i, motorValue[i]);
+	motorCommit();
 }
 
 void carMove(int16_t v, int dir) {
-	int16_t motorValue[MOTOR_NBR] = { v, v, v, v };
 	switch (dir) {
 		case LEFT:
-			motorValue[1] = -motorValue[1];
-			motorValue[3] = -motorValue[3];
+			carDriveAxis(CAR_AXIS_ROLL, v);
 			break;
 		case RIGHT:
-			motorValue[0] = -motorValue[0];
-			motorValue[2] = -motorValue[2];
+			carDriveAxis(CAR_AXIS_ROLL, -v);
+			break;
+		case BACK:
+			carDriveAxis(CAR_AXIS_PITCH, -v);
 			break;
 		case FRONT:
+		default:
+			carDriveAxis(CAR_AXIS_PITCH, v);
 			break;
-		case BACK:
-			for (int i = 0; i < MOTOR_NBR; i++)
-				motorValue[i] = -motorValue[i];
 	}
-	for (int i = 0; i < MOTOR_NBR; i++)
-		motorSetRatio(i, motorValue[i]);
 }
 
 void carRotate(int16_t r) {
-	bool dir = r < 0;
-	if (dir) r = -r;
-	int16_t motorValue[MOTOR_NBR] = { -r, -r, r, r };
-	if (dir) {
-		for (int i = 0; i < MOTOR_NBR; i++)
-			motorValue[i] = -motorValue[i];
-	}
-	for (int i = 0; i < MOTOR_NBR; i++)
-		motorSetRatio(i, motorValue[i]);
+	carDriveAxis(CAR_AXIS_YAW, r);
 }
 
 void carStart(){
-	motorSetRatio(0, 20000);
-	motorSetRatio(1, -20000);
-	motorSetRatio(2, -20000);
-	motorSetRatio(3, 20000);
+	motorStage(0, 20000);
+	motorStage(1, -20000);
+	motorStage(2, -20000);
+	motorStage(3, 20000);
+	motorCommit();
 	HAL_Delay(100);
 	carStop();
 }
 	
 void carStop() {
 	for (int i = 0; i < MOTOR_NBR; i++)
-		motorSetRatio(i, 0);
+		motorStage(i, 0);
+	motorCommit();
+}
+
+/*! The only float operations left, once per axis rather than per motor */
+static inline int32_t carRatioToQ15(float ratio) {
+	/*! Only reached by infinities and NaN, carMix scales every finite ratio within the limit */
+	if (ratio > CAR_RATIO_LIMIT) ratio = CAR_RATIO_LIMIT;
+	else if (!(ratio >= -CAR_RATIO_LIMIT)) ratio = -CAR_RATIO_LIMIT;
+	return ratio * (float)(1 << 15);
+}
+
+static inline float carRatioMagnitude(float ratio) {
+	return ratio < 0 ? -ratio : ratio;
+}
+
+/*!
+ * The ratios share one exponent: when one exceeds CAR_RATIO_LIMIT, they are all
+ * halved until it fits, which is exact in float, and carMixQ15Scaled scales the
+ * sum back up. Opposing axes then cancel like they do in float, a clamp per
+ * axis would not let them.
+ */
+static void carMixLarge(const setpoint_t *sp, float peak, int32_t command[MOTOR_NBR]) {
+	float scale = 1.0f;
+	int shift = 0;
+
+	while (peak > CAR_RATIO_LIMIT && shift < CAR_RATIO_SHIFT_MAX) {
+		peak *= 0.5f;
+		scale *= 0.5f;
+		shift++;
+	}
+
+	int32_t ratio[CAR_AXIS_COUNT] = {
+		[CAR_AXIS_PITCH] = carRatioToQ15(sp->pitch * scale),
+		[CAR_AXIS_ROLL] = carRatioToQ15(sp->roll * scale),
+		[CAR_AXIS_YAW] = carRatioToQ15(sp->yaw * scale),
+	};
+	carMixQ15Scaled(ratio, sp->thrust, shift, command);
 }
 
+static void carMix(const setpoint_t *sp, int32_t command[MOTOR_NBR]) {
+	float peak = carRatioMagnitude(sp->pitch);
 
+	if (carRatioMagnitude(sp->roll) > peak) peak = carRatioMagnitude(sp->roll);
+	if (carRatioMagnitude(sp->yaw) > peak) peak = carRatioMagnitude(sp->yaw);
+	if (peak > CAR_RATIO_LIMIT) {
+		carMixLarge(sp, peak, command);
+	} else {
+		int32_t ratio[CAR_AXIS_COUNT] = {
+			[CAR_AXIS_PITCH] = carRatioToQ15(sp->pitch),
+			[CAR_AXIS_ROLL] = carRatioToQ15(sp->roll),
+			[CAR_AXIS_YAW] = carRatioToQ15(sp->yaw),
+		};
+		carMixQ15(ratio, sp->thrust, command);
+	}
+	carNormalize(command, MOTOR_THRUST_LIMIT);
+}
+
+/*! Float reference of carMix, kept for carBenchmark */
+static void carMixFloat(const setpoint_t *sp, int32_t command[MOTOR_NBR]) {
+	const CarMixerTable *table = mixerActive;
+	for (int m = 0; m < MOTOR_NBR; m++) {
+		command[m] = sp->thrust * (table->coeff[m][CAR_AXIS_PITCH] * sp->pitch +
+				table->coeff[m][CAR_AXIS_ROLL] * sp->roll + table->coeff[m][CAR_AXIS_YAW] * sp->yaw);
+	}
+	carNormalize(command, MOTOR_THRUST_LIMIT);
+}
 
 void carSet(setpoint_t *sp) {
-	int motorValue[MOTOR_NBR] = { 0 };
-	motorValue[0] = sp->thrust * (sp->pitch + sp->roll - sp->yaw);
-	motorValue[1] = sp->thrust * (sp->pitch - sp->roll - sp->yaw);
-	motorValue[2] = sp->thrust * (sp->pitch + sp->roll + sp->yaw);
-	motorValue[3] = sp->thrust * (sp->pitch - sp->roll + sp->yaw);
-	for (int i = 0; i < MOTOR_NBR; i++) {
-		if (motorValue[i] > 0) {
-			motorValue[i] += thrustBase;
-			if (motorValue[i] > MOTOR_MAX_THRUST) motorValue[i] = MOTOR_MAX_THRUST;
+	int32_t motorValue[MOTOR_NBR];
+	carMix(sp, motorValue);
+	for (int i = 0; i < MOTOR_NBR; i++)
+		motorStage(i, motorValue[i]);
+	motorCommit();
+}
+
+/*!
+ * Q15 ratios in [-1, 1) like the compact setpoints, with the extremes more
+ * likely, and some in [-4096, 4096) like a float setpoint or an overshooting
+ * trajectory. Larger ones could overflow the int conversion of the float reference.
+ */
+static float carBenchmarkRatio(uint32_t *seed) {
+	*seed = *seed * 1664525 + 1013904223;
+	switch (*seed >> 29) {
+		case 0: return -1.0f;
+		case 1: return 0.0f;
+		case 2: return (int16_t)(*seed >> 8) / 8.0f;
+		default: return (int16_t)(*seed >> 8) / 32768.0f;
+	}
+}
+
+void carBenchmark(uint32_t samples, CarBenchmark *result) {
+	setpoint_t sp[CAR_BENCHMARK_BATCH];
+	int32_t fixedCommand[CAR_BENCHMARK_BATCH][MOTOR_NBR], floatCommand[CAR_BENCHMARK_BATCH][MOTOR_NBR];
+	uint32_t fixedCompare[CAR_BENCHMARK_BATCH][MOTOR_NBR], floatCompare[CAR_BENCHMARK_BATCH][MOTOR_NBR];
+	uint32_t seed = 1, start;
+
+	*result = (CarBenchmark){ 0 };
+	for (uint32_t done = 0; done < samples; done += CAR_BENCHMARK_BATCH) {
+		int n = samples - done < CAR_BENCHMARK_BATCH ? samples - done : CAR_BENCHMARK_BATCH;
+
+		for (int i = 0; i < n; i++) {
+			sp[i].roll = carBenchmarkRatio(&seed);
+			sp[i].pitch = carBenchmarkRatio(&seed);
+			sp[i].yaw = carBenchmarkRatio(&seed);
+			seed = seed * 1664525 + 1013904223;
+			/*! Every magnitude, so that large ratios are also tried below saturation */
+			sp[i].thrust = (seed >> 16) >> ((seed >> 12) & 15);
+		}
+
+		/*! Both paths time the same batch, without being preempted in between */
+		taskENTER_CRITICAL();
+		start = cycleCounterGet();
+		for (int i = 0; i < n; i++) {
+			carMixFloat(&sp[i], floatCommand[i]);
+			for (int m = 0; m < MOTOR_NBR; m++)
+				floatCompare[i][m] = motorCompareFloat(m, motorLutApply(&motorLut[m][floatCommand[i][m] < 0],
+						motorMagnitude(floatCommand[i][m])));
 		}
-		else {
-			motorValue[i] -= thrustBase;
-			if (motorValue[i] < -MOTOR_MAX_THRUST) motorValue[i] = -MOTOR_MAX_THRUST;
+		result->floatCycles += cycleCounterGet() - start;
+		start = cycleCounterGet();
+		for (int i = 0; i < n; i++) {
+			carMix(&sp[i], fixedCommand[i]);
+			for (int m = 0; m < MOTOR_NBR; m++)
+				fixedCompare[i][m] = motorCompare(m, motorLutApply(&motorLut[m][fixedCommand[i][m] < 0],
+						motorMagnitude(fixedCommand[i][m])));
 		}
-		motorSetRatio(i, motorValue[i]);
+		result->fixedCycles += cycleCounterGet() - start;
+		taskEXIT_CRITICAL();
+
+		for (int i = 0; i < n; i++) {
+			for (int m = 0; m < MOTOR_NBR; m++) {
+				int32_t error = fixedCommand[i][m] - floatCommand[i][m];
+				bool fixedSaturated = fixedCommand[i][m] == MOTOR_THRUST_LIMIT || fixedCommand[i][m] == -MOTOR_THRUST_LIMIT;
+				bool floatSaturated = floatCommand[i][m] == MOTOR_THRUST_LIMIT || floatCommand[i][m] == -MOTOR_THRUST_LIMIT;
+
+				if (error < 0) error = -error;
+				if (error) result->commandMismatches++;
+				if ((uint32_t)error > result->maxCommandError) result->maxCommandError = error;
+				if (fixedSaturated != floatSaturated) result->saturationMismatches++;
+				if (fixedCompare[i][m] != floatCompare[i][m]) result->compareMismatches++;
+			}
+		}
+		result->samples += n;
 	}
-}
\ No newline at end of file
+}
@@ -1,44 +1,261 @@
+#include <string.h>
+
 #include "controller.h"
 
 #include "static_mem.h"
+#include "task.h"
 #include "crtp.h"
+#include "crtp_pool.h"
 #include "car_driver.h"
-#include "debug.h"
+#include "deferlog.h"
 #include "config.h"
+#include "cyclecounter.h"
+#include "latency.h"
+#include "trajectory.h"
+
+#define CONTROLLER_SETPOINT_TIMEOUT 500
+#define CONTROLLER_JITTER_BIN_US 10
+#define CONTROLLER_EXEC_BIN_US 5
+#define CONTROLLER_SCHEDULE_SIZE 8
+
+/* The control period is a whole number of kernel ticks */
+_Static_assert(configTICK_RATE_HZ % CONTROLLER_RATE_HZ == 0 && CONTROLLER_RATE_HZ <= configTICK_RATE_HZ,
+		"CONTROLLER_RATE_HZ must divide configTICK_RATE_HZ");
+
+/* Single slot mailbox, only the latest setpoint matters */
+typedef struct {
+	setpoint_t setpoint;
+	uint32_t seq;		// incremented on every write
+	uint32_t timestamp;	// arrival tick
+	uint32_t rxStamp;	// cycle counter at USB reception, 0 if not traced
+	uint32_t dispatchStamp;	// cycle counter at CRTP dispatch
+	bool stop;		// stop the motors rather than apply 'setpoint'
+} SetpointMailbox;
+
+/* Future setpoints, sorted by due tick, moved to the mailbox when due */
+typedef struct {
+	setpoint_t setpoint[CONTROLLER_SCHEDULE_SIZE];
+	uint32_t due[CONTROLLER_SCHEDULE_SIZE];
+	int count;
+	int next;
+} SetpointSchedule;
 
 STATIC_MEM_TASK_ALLOC(controllerTask, CONTROLLER_TASK_STACKSIZE);
-static osMessageQueueId_t rxQueue;
 static bool isInit = false;
+static SetpointMailbox mailbox;
+static SetpointSchedule schedule;
+static ControllerStats stats;
+static setpoint_t output;	// Last setpoint applied to the motors, zeros while stopped
+static Histogram periodJitter;
+static Histogram execTime;
 static void controllerTask();
 static void controllerDispatchPacket(CRTPPacket *p);
-
-CRTPPacket cp;
+static void controllerDispatchFast(const CRTPPacket *p, uint32_t rxStamp);
 
 void controllerInit() {
 	if (isInit)
 		return;
 
-	rxQueue = osMessageQueueNew(10, sizeof(CRTPPacket), NULL);
+	histogramInit(&periodJitter, CONTROLLER_JITTER_BIN_US);
+	histogramInit(&execTime, CONTROLLER_EXEC_BIN_US);
+#if CONTROLLER_FAST_PATH
+	crtpRegisterFastPath(CRTP_PORT_SETPOINT, 0, controllerDispatchFast);
+#endif
 	crtpRegisterPortCB(CRTP_PORT_SETPOINT, controllerDispatchPacket);
 
 	STATIC_MEM_TASK_CREATE(controllerTask, controllerTask, CONTROLLER_TASK_NAME, NULL, CONTROLLER_TASK_PRI);
 	isInit = true;
 }
 
-void controllerDispatchPacket(CRTPPacket *p) {
-	osMessageQueuePut(rxQueue, p, 0, osWaitForever);
+/* A low level setpoint takes over from the trajectory executor, and from the schedule unless it comes from it */
+static void controllerSetpointPutTraced(const setpoint_t *sp, uint32_t rxStamp, uint32_t dispatchStamp, bool fromSchedule) {
+	trajectoryStop();
+	motorAbortOverride();
+	UBaseType_t mask = taskENTER_CRITICAL_FROM_ISR();
+	if (!fromSchedule)
+		schedule.count = 0;
+	mailbox.setpoint = *sp;
+	mailbox.seq++;
+	mailbox.timestamp = osKernelGetTickCount();
+	mailbox.rxStamp = rxStamp;
+	mailbox.dispatchStamp = dispatchStamp;
+	mailbox.stop = false;
+	stats.received++;
+	taskEXIT_CRITICAL_FROM_ISR(mask);
+}
+
+void controllerSetpointPut(const setpoint_t *sp) {
+	controllerSetpointPutTraced(sp, 0, 0, false);
+}
+
+void controllerSetpointPutRx(const setpoint_t *sp, uint32_t rxStamp) {
+	uint32_t now = cycleCounterGet();
+
+	latencyRecord(LATENCY_USB_TO_DISPATCH, rxStamp, now);
+	controllerSetpointPutTraced(sp, rxStamp, now, false);
+}
+
+void controllerStop(void) {
+	trajectoryStop();
+	motorAbortOverride();
+	UBaseType_t mask = taskENTER_CRITICAL_FROM_ISR();
+	schedule.count = 0;
+	mailbox.seq++;
+	mailbox.timestamp = osKernelGetTickCount();
+	mailbox.rxStamp = 0;
+	mailbox.stop = true;
+	stats.received++;
+	taskEXIT_CRITICAL_FROM_ISR(mask);
+}
+
+void controllerSchedule(const setpoint_t *sp, const uint32_t *due, int count) {
+	if (count > CONTROLLER_SCHEDULE_SIZE)
+		count = CONTROLLER_SCHEDULE_SIZE;
+
+	UBaseType_t mask = taskENTER_CRITICAL_FROM_ISR();
+	memcpy(schedule.setpoint, sp, count * sizeof(setpoint_t));
+	memcpy(schedule.due, due, count * sizeof(uint32_t));
+	schedule.count = count;
+	schedule.next = 0;
+	taskEXIT_CRITICAL_FROM_ISR(mask);
+}
+
+/* Publish the latest schedule entry that is due, the ones it passed are superseded */
+static void controllerScheduleRun(uint32_t tick) {
+	setpoint_t sp;
+	bool due = false;
+
+	UBaseType_t mask = taskENTER_CRITICAL_FROM_ISR();
+	while (schedule.next < schedule.count && (int32_t)(tick - schedule.due[schedule.next]) >= 0) {
+		sp = schedule.setpoint[schedule.next++];
+		due = true;
+	}
+	taskEXIT_CRITICAL_FROM_ISR(mask);
+
+	if (due)
+		controllerSetpointPutTraced(&sp, 0, 0, true);
+}
+
+static void controllerSetpointGet(SetpointMailbox *mb) {
+	UBaseType_t mask = taskENTER_CRITICAL_FROM_ISR();
+	*mb = mailbox;
+	taskEXIT_CRITICAL_FROM_ISR(mask);
+}
+
+void controllerGetOutput(setpoint_t *sp) {
+	UBaseType_t mask = taskENTER_CRITICAL_FROM_ISR();
+	*sp = output;
+	taskEXIT_CRITICAL_FROM_ISR(mask);
+}
+
+static void controllerSetOutput(const setpoint_t *sp) {
+	UBaseType_t mask = taskENTER_CRITICAL_FROM_ISR();
+	output = *sp;
+	taskEXIT_CRITICAL_FROM_ISR(mask);
+}
+
+void controllerGetStats(ControllerStats *s) {
+	UBaseType_t mask = taskENTER_CRITICAL_FROM_ISR();
+	*s = stats;
+	taskEXIT_CRITICAL_FROM_ISR(mask);
+}
+
+void controllerGetTiming(Histogram *jitter, Histogram *exec) {
+	taskENTER_CRITICAL();
+	*jitter = periodJitter;
+	*exec = execTime;
+	taskEXIT_CRITICAL();
+}
+
+void controllerResetTiming(void) {
+	taskENTER_CRITICAL();
+	histogramInit(&periodJitter, CONTROLLER_JITTER_BIN_US);
+	histogramInit(&execTime, CONTROLLER_EXEC_BIN_US);
+	taskEXIT_CRITICAL();
+}
+
+static void controllerDispatchFast(const CRTPPacket *p, uint32_t rxStamp) {
+	setpoint_t sp;
+
+	if (p->size < sizeof(setpoint_t))
+		return;
+	/* The packet data is not aligned for float loads */
+	memcpy(&sp, p->data, sizeof(sp));
+	controllerSetpointPutRx(&sp, rxStamp);
+}
+
+static void controllerDispatchPacket(CRTPPacket *p) {
+	controllerDispatchFast(p, crtpPoolGetTimestamp(p));
+}
+
+/* Runs once per control period with the latest setpoint */
+static void controllerUpdate(uint32_t tick, uint32_t *lastSeq) {
+	static const setpoint_t stopped;
+	static uint32_t expiredSeq;
+	SetpointMailbox mb;
+	setpoint_t plan;
+
+	controllerScheduleRun(tick);
+	/* The executor keeps its own timing, the mailbox timeout does not apply */
+	if (trajectoryUpdate(tick, &plan)) {
+		carSet(&plan);
+		controllerSetOutput(&plan);
+		return;
+	}
+
+	controllerSetpointGet(&mb);
+	if (mb.seq == 0 || mb.stop || tick - mb.timestamp > CONTROLLER_SETPOINT_TIMEOUT) {
+		/* A setpoint that just timed out stops a sweep like controllerStop, a stale one does not */
+		if (mb.seq != 0 && !mb.stop && mb.seq != expiredSeq) {
+			expiredSeq = mb.seq;
+			motorAbortOverride();
+		}
+		carStop();
+		controllerSetOutput(&stopped);
+		return;
+	}
+
+	if (mb.seq == *lastSeq) {
+		carSet(&mb.setpoint);
+		controllerSetOutput(&mb.setpoint);
+		return;
+	}
+
+	uint32_t pickup = cycleCounterGet();
+	stats.superseded += mb.seq - *lastSeq - 1;
+	stats.applied++;
+	*lastSeq = mb.seq;
+	/* carSet() ends with the last compare register write */
+	carSet(&mb.setpoint);
+
+	uint32_t pwm = cycleCounterGet();
+	controllerSetOutput(&mb.setpoint);
+	if (mb.rxStamp) {
+		latencyRecord(LATENCY_DISPATCH_TO_CONTROLLER, mb.dispatchStamp, pickup);
+		latencyRecord(LATENCY_CONTROLLER_TO_PWM, pickup, pwm);
+		latencyRecord(LATENCY_TOTAL, mb.rxStamp, pwm);
+	}
+	DEBUG_PRINT_DEFER("Set: %f %f %f %d\n", mb.setpoint.roll, mb.setpoint.pitch, mb.setpoint.yaw, mb.setpoint.thrust);
 }
 
 void controllerTask() {
-	setpoint_t* sp;
+	uint32_t period = osKernelGetTickFreq() / CONTROLLER_RATE_HZ;
+	uint32_t periodCycles = cycleCounterFromUs(1000000 / CONTROLLER_RATE_HZ);
+	uint32_t wakeTick = osKernelGetTickCount();
+	uint32_t lastStart = cycleCounterGet();
+	uint32_t start, elapsed, lastSeq = 0;
+
 	while (1) {
-		if (osMessageQueueGet(rxQueue, &cp, NULL, 500) == osOK) {
-			sp = (setpoint_t *) cp.data;
-			DEBUG_PRINT_UART("Set: %f %f %f %d\n", sp->roll, sp->pitch, sp->yaw, sp->thrust);
-			carSet(sp);
-		} else {
-			carStop();
-		}
-		osDelay(1);
+		wakeTick += period;
+		osDelayUntil(wakeTick);
+
+		start = cycleCounterGet();
+		elapsed = start - lastStart;
+		lastStart = start;
+		histogramAdd(&periodJitter, cycleCounterToUs(elapsed > periodCycles ? elapsed - periodCycles : periodCycles - elapsed));
+
+		controllerUpdate(wakeTick, &lastSeq);
+
+		histogramAdd(&execTime, cycleCounterToUs(cycleCounterGet() - start));
 	}
-}
\ No newline at end of file
+}
@@ -26,10 +26,13 @@
 
 #include <stdbool.h>
 #include <errno.h>
+#include <string.h>
 
 #include "config.h"
 #include "crtp.h"
+#include "crtp_pool.h"
 #include "static_mem.h"
+#include "task.h"
 #include "debug.h"
 #include "cfassert.h"
 
@@ -42,31 +45,82 @@ static struct crtpLinkOperations nopLink = {
   .receivePacket     = (void*) nopFunc,
 };
 
-static struct crtpLinkOperations *link = &nopLink;
+/*! Slot 0 is the primary link, each slot has its own receive task */
+static struct crtpLinkOperations *links[CRTP_MAX_LINKS] = { &nopLink, &nopLink };
 
 #define CRTP_NBR_OF_PORTS 16
-#define CRTP_TX_QUEUE_SIZE 120
+/*! Queues only carry pool packet pointers, so all lanes together never need more entries than the pool */
+#define CRTP_TX_CONTROL_QUEUE_SIZE 8
+#define CRTP_TX_TELEMETRY_QUEUE_SIZE 24
+#define CRTP_TX_BULK_QUEUE_SIZE 16
+#define CRTP_TX_QUEUE_SIZE (CRTP_TX_CONTROL_QUEUE_SIZE + CRTP_TX_TELEMETRY_QUEUE_SIZE + CRTP_TX_BULK_QUEUE_SIZE)
 #define CRTP_RX_QUEUE_SIZE 16
-
-static osMessageQueueId_t txQueue;
+/*! Upper bound of one link send attempt, the link is looked up again after it */
+#define CRTP_TX_WAIT_MS 100
+
+static osMessageQueueId_t txQueues[CRTP_TX_LANE_COUNT];
+/*! Counts packets over all lanes, so the TX task has a single thing to wait on */
+static osSemaphoreId_t txPending;
+static uint16_t txHighWater[CRTP_TX_LANE_COUNT];
+static uint32_t txDropped[CRTP_TX_LANE_COUNT];
 static osMessageQueueId_t queues[CRTP_NBR_OF_PORTS];
+static CrtpQueuePolicy queuePolicy[CRTP_NBR_OF_PORTS];
+static uint32_t queueDropped[CRTP_NBR_OF_PORTS];
+static uint16_t queueHighWater[CRTP_NBR_OF_PORTS];
+/*! Counted from both crtpRxTask instances and from the link tasks' fast path, see crtpCountRx */
+static uint32_t rxPackets[CRTP_NBR_OF_PORTS];
+static uint32_t rxBytes[CRTP_NBR_OF_PORTS];
+static uint32_t txPackets[CRTP_NBR_OF_PORTS];
+static uint32_t txBytes[CRTP_NBR_OF_PORTS];
+static uint32_t txPortDropped[CRTP_NBR_OF_PORTS];
+static uint32_t linkRetries;
+static uint8_t portRoute[CRTP_NBR_OF_PORTS];
+
+static const uint32_t txQueueSize[CRTP_TX_LANE_COUNT] = {
+  [CRTP_TX_LANE_CONTROL]   = CRTP_TX_CONTROL_QUEUE_SIZE,
+  [CRTP_TX_LANE_TELEMETRY] = CRTP_TX_TELEMETRY_QUEUE_SIZE,
+  [CRTP_TX_LANE_BULK]      = CRTP_TX_BULK_QUEUE_SIZE,
+};
+
+static CrtpTxLane portLane[CRTP_NBR_OF_PORTS] = {
+  [CRTP_PORT_CONSOLE]          = CRTP_TX_LANE_BULK,
+  [CRTP_PORT_PARAM]            = CRTP_TX_LANE_TELEMETRY,
+  [CRTP_PORT_SETPOINT]         = CRTP_TX_LANE_CONTROL,
+  [CRTP_PORT_MEM]              = CRTP_TX_LANE_BULK,
+  [CRTP_PORT_LOG]              = CRTP_TX_LANE_TELEMETRY,
+  [CRTP_PORT_LOCALIZATION]     = CRTP_TX_LANE_TELEMETRY,
+  [CRTP_PORT_SETPOINT_GENERIC] = CRTP_TX_LANE_CONTROL,
+  [CRTP_PORT_SETPOINT_HL]      = CRTP_TX_LANE_CONTROL,
+  [CRTP_PORT_PLATFORM]         = CRTP_TX_LANE_CONTROL,
+  [CRTP_PORT_LINK]             = CRTP_TX_LANE_CONTROL,
+};
 
 static void crtpTxTask(void *param);
 static void crtpRxTask(void *param);
 
-static volatile CrtpCallback callbacks[CRTP_NBR_OF_PORTS];
+/*! Subscribers of each (port, channel), NULL in the free slots. Readers skip them rather than stop */
+static CrtpCallback volatile callbacks[CRTP_NBR_OF_PORTS][CRTP_NBR_OF_CHANNELS][CRTP_MAX_SUBSCRIBERS];
+static volatile CrtpFastCallback fastPaths[CRTP_NBR_OF_PORTS][CRTP_NBR_OF_CHANNELS];
 
 STATIC_MEM_TASK_ALLOC_STACK_NO_DMA_CCM_SAFE(crtpTxTask, CRTP_TX_TASK_STACKSIZE);
 STATIC_MEM_TASK_ALLOC_STACK_NO_DMA_CCM_SAFE(crtpRxTask, CRTP_RX_TASK_STACKSIZE);
+STATIC_MEM_TASK_ALLOC_STACK_NO_DMA_CCM_SAFE(crtpRxTask1, CRTP_RX_TASK_STACKSIZE);
 
 void crtpInit(void) {
   if (isInit)
     return;
 
-  txQueue = osMessageQueueNew(CRTP_TX_QUEUE_SIZE, sizeof(CRTPPacket), NULL);
+  crtpPoolInit();
+  for (int i = 0; i < CRTP_TX_LANE_COUNT; i++)
+    txQueues[i] = osMessageQueueNew(txQueueSize[i], sizeof(CRTPPacket *), NULL);
+  txPending = osSemaphoreNew(CRTP_TX_QUEUE_SIZE, 0, NULL);
+  for (int i = 0; i < CRTP_NBR_OF_PORTS; i++)
+    portRoute[i] = CRTP_LINK_MASK(0);
 
   STATIC_MEM_TASK_CREATE(crtpTxTask, crtpTxTask, CRTP_TX_TASK_NAME, NULL, CRTP_TX_TASK_PRI);
-  STATIC_MEM_TASK_CREATE(crtpRxTask, crtpRxTask, CRTP_RX_TASK_NAME, NULL, CRTP_RX_TASK_PRI);
+  /*! One receive task per link slot, so a link waiting for data never delays the other */
+  STATIC_MEM_TASK_CREATE(crtpRxTask, crtpRxTask, CRTP_RX_TASK_NAME, (void *)0, CRTP_RX_TASK_PRI);
+  STATIC_MEM_TASK_CREATE(crtpRxTask1, crtpRxTask, CRTP_RX1_TASK_NAME, (void *)1, CRTP_RX_TASK_PRI);
 
   isInit = true;
 }
@@ -75,112 +129,464 @@ bool crtpTest(void) {
   return isInit;
 }
 
-void crtpInitTaskQueue(CRTPPort portId) {
+void crtpInitTaskQueuePolicy(CRTPPort portId, CrtpQueuePolicy policy) {
+  ASSERT(portId < CRTP_NBR_OF_PORTS);
   ASSERT(queues[portId] == NULL);
-  queues[portId] = osMessageQueueNew(CRTP_RX_QUEUE_SIZE, sizeof(CRTPPacket), NULL);
+  queuePolicy[portId] = policy;
+  queues[portId] = osMessageQueueNew(policy == CRTP_QUEUE_OVERWRITE_LATEST ? 1 : CRTP_RX_QUEUE_SIZE,
+                                     sizeof(CRTPPacket *), NULL);
 }
 
-int crtpReceivePacket(CRTPPort portId, CRTPPacket *p) {
-  ASSERT(queues[portId]);
-  ASSERT(p);
-  return osMessageQueueGet(queues[portId], p, NULL, 0);
+void crtpInitTaskQueue(CRTPPort portId) {
+  crtpInitTaskQueuePolicy(portId, CRTP_QUEUE_BLOCK);
 }
 
-int crtpReceivePacketBlock(CRTPPort portId, CRTPPacket *p) {
+uint32_t crtpGetPortDropped(CRTPPort portId) {
+  ASSERT(portId < CRTP_NBR_OF_PORTS);
+  return queueDropped[portId];
+}
+
+void crtpGetPortStats(CRTPPort port, CrtpPortStats *stats) {
+  ASSERT(port < CRTP_NBR_OF_PORTS);
+  stats->rxPackets = __atomic_load_n(&rxPackets[port], __ATOMIC_RELAXED);
+  stats->rxBytes = __atomic_load_n(&rxBytes[port], __ATOMIC_RELAXED);
+  stats->rxDropped = queueDropped[port];
+  stats->txPackets = txPackets[port];
+  stats->txBytes = txBytes[port];
+  stats->txDropped = txPortDropped[port];
+  stats->rxHighWater = queueHighWater[port];
+}
+
+uint32_t crtpGetLinkRetries(void) {
+  return linkRetries;
+}
+
+static void crtpRxHighWater(uint8_t port) {
+  uint32_t count = osMessageQueueGetCount(queues[port]);
+
+  if (count > queueHighWater[port])
+    queueHighWater[port] = count;
+}
+
+/*! Hands the packet over to the port consumer, or frees it according to the port policy */
+static void crtpRxEnqueue(CRTPPacket *p) {
+  osMessageQueueId_t queue = queues[p->port];
+  CRTPPacket *old;
+
+  switch (queuePolicy[p->port]) {
+    case CRTP_QUEUE_BLOCK:
+      osMessageQueuePut(queue, &p, 0, osWaitForever);
+      crtpRxHighWater(p->port);
+      return;
+    case CRTP_QUEUE_DROP_NEWEST:
+      break;
+    case CRTP_QUEUE_DROP_OLDEST:
+    case CRTP_QUEUE_OVERWRITE_LATEST:
+      if (osMessageQueuePut(queue, &p, 0, 0) == osOK) {
+        crtpRxHighWater(p->port);
+        return;
+      }
+      /*! The consumer may have emptied the queue meanwhile, then the retry simply succeeds */
+      if (osMessageQueueGet(queue, &old, NULL, 0) == osOK) {
+        crtpPoolFree(old);
+        queueDropped[p->port]++;
+      }
+      break;
+  }
+
+  if (osMessageQueuePut(queue, &p, 0, 0) != osOK) {
+    queueDropped[p->port]++;
+    crtpPoolFree(p);
+    return;
+  }
+  crtpRxHighWater(p->port);
+}
+
+int crtpReceivePacketRef(CRTPPort portId, CRTPPacket **p, int wait) {
   ASSERT(queues[portId]);
   ASSERT(p);
-  return osMessageQueueGet(queues[portId], p, NULL, osWaitForever);
+  return osMessageQueueGet(queues[portId], p, NULL, wait);
 }
 
 int crtpReceivePacketWait(CRTPPort portId, CRTPPacket *p, int wait) {
-  ASSERT(queues[portId]);
+  CRTPPacket *pk;
+  int status;
+
   ASSERT(p);
-  return osMessageQueueGet(queues[portId], p, NULL, wait);
+  status = crtpReceivePacketRef(portId, &pk, wait);
+  if (status == osOK) {
+    *p = *pk;
+    crtpPoolFree(pk);
+  }
+  return status;
+}
+
+int crtpReceivePacket(CRTPPort portId, CRTPPacket *p) {
+  return crtpReceivePacketWait(portId, p, 0);
+}
+
+int crtpReceivePacketBlock(CRTPPort portId, CRTPPacket *p) {
+  return crtpReceivePacketWait(portId, p, osWaitForever);
 }
 
 int crtpGetFreeTxQueuePackets(void) {
-  return osMessageQueueGetSpace(txQueue);
+  int space = 0;
+
+  for (int i = 0; i < CRTP_TX_LANE_COUNT; i++)
+    space += osMessageQueueGetSpace(txQueues[i]);
+  return space;
+}
+
+void crtpSetPortTxLane(CRTPPort port, CrtpTxLane lane) {
+  ASSERT(port < CRTP_NBR_OF_PORTS);
+  ASSERT(lane < CRTP_TX_LANE_COUNT);
+  portLane[port] = lane;
+}
+
+void crtpGetTxLaneStats(CrtpTxLane lane, CrtpTxLaneStats *stats) {
+  ASSERT(lane < CRTP_TX_LANE_COUNT);
+  stats->count = osMessageQueueGetCount(txQueues[lane]);
+  stats->highWater = txHighWater[lane];
+  stats->dropped = txDropped[lane];
+}
+
+static bool crtpLinkConnected(int index) {
+  struct crtpLinkOperations *lk = links[index];
+
+  if (lk == &nopLink)
+    return false;
+  if (lk->isConnected)
+    return lk->isConnected();
+  return true;
+}
+
+static uint8_t crtpConnectedLinks(void) {
+  uint8_t mask = 0;
+
+  for (int i = 0; i < CRTP_MAX_LINKS; i++) {
+    if (crtpLinkConnected(i))
+      mask |= CRTP_LINK_MASK(i);
+  }
+  return mask;
+}
+
+/*! Subset of 'connected' that heard from its host lately, links without the hint always count */
+static uint8_t crtpActiveLinks(uint8_t connected) {
+  uint8_t mask = 0;
+
+  for (int i = 0; i < CRTP_MAX_LINKS; i++) {
+    if ((connected & CRTP_LINK_MASK(i)) && (!links[i]->isActive || links[i]->isActive()))
+      mask |= CRTP_LINK_MASK(i);
+  }
+  return mask;
+}
+
+/*! Links to send 'p' on: its origin, else its port route, else the first active or connected link */
+static uint8_t crtpTxLinks(const CRTPPacket *p, uint8_t connected) {
+  uint8_t active = crtpActiveLinks(connected);
+  uint8_t mask;
+
+  if (p->link != CRTP_LINK_ROUTE && p->link <= CRTP_MAX_LINKS &&
+      (connected & CRTP_LINK_MASK(p->link - 1)))
+    return CRTP_LINK_MASK(p->link - 1);
+
+  mask = portRoute[p->port] & active;
+  if (mask)
+    return mask;
+  mask = portRoute[p->port] & connected;
+  if (mask)
+    return mask;
+
+  /*! Lowest set bit, the primary link first */
+  mask = active ? active : connected;
+  return mask & -mask;
+}
+
+static bool crtpLinkSend(struct crtpLinkOperations *lk, CRTPPacket *p) {
+
+  /*! Links signalling TX completion wake us as soon as there is room */
+  if (lk->sendPacketWait)
+    return lk->sendPacketWait(p, CRTP_TX_WAIT_MS);
+
+  if (lk->sendPacket(p))
+    return true;
+  osDelay(10);
+  return false;
+}
+
+/*! Highest priority non-empty lane first */
+static bool crtpTxDequeue(CRTPPacket **p) {
+  for (int i = 0; i < CRTP_TX_LANE_COUNT; i++) {
+    if (osMessageQueueGet(txQueues[i], p, NULL, 0) == osOK)
+      return true;
+  }
+  return false;
+}
+
+/*! Sends on every link of the route, a link going down meanwhile is given up. True if any link took it */
+static bool crtpTxRoute(CRTPPacket *p) {
+  uint8_t connected = crtpConnectedLinks();
+  uint8_t mask = crtpTxLinks(p, connected);
+  bool sent = false;
+  bool ok;
+
+  for (int i = 0; i < CRTP_MAX_LINKS; i++) {
+    if (!(mask & CRTP_LINK_MASK(i)))
+      continue;
+    while (!(ok = crtpLinkSend(links[i], p))) {
+      linkRetries++;
+      if (!crtpLinkConnected(i))
+        break;
+    }
+    sent |= ok;
+  }
+  return sent;
 }
 
 void crtpTxTask(void *param) {
-  CRTPPacket p;
+  CRTPPacket *p;
 
   while (1) {
-    if (link != &nopLink) {
-      if (osMessageQueueGet(txQueue, &p, 0, osWaitForever) == osOK) {
-        /*! Keep testing, if the link changes to USB it will go though */
-        while (link->sendPacket(&p) == false)
-          osDelay(10);
+    if (crtpConnectedLinks()) {
+      if (osSemaphoreAcquire(txPending, osWaitForever) == osOK && crtpTxDequeue(&p)) {
+        if (crtpTxRoute(p)) {
+          txPackets[p->port]++;
+          txBytes[p->port] += p->size + 1;
+        } else {
+          txPortDropped[p->port]++;
+        }
+        crtpPoolFree(p);
       }
     } else
       osDelay(10);
   }
 }
 
+static inline void crtpCountRx(uint8_t port, uint32_t bytes) {
+  __atomic_fetch_add(&rxPackets[port], 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&rxBytes[port], bytes, __ATOMIC_RELAXED);
+}
+
 void crtpRxTask(void *param) {
-  CRTPPacket p;
+  int index = (int)(intptr_t)param;
+  struct crtpLinkOperations *lk;
+  CRTPPacket *p;
 
   while (1) {
-    if (link != &nopLink) {
-      if (!link->receivePacket(&p)) {
-        if (queues[p.port])
-          /*! Block, since we should never drop a packet */
-          osMessageQueuePut(queues[p.port], &p, 0, osWaitForever);
-
-        if (callbacks[p.port])
-          callbacks[p.port](&p);
+    lk = links[index];
+    if (lk != &nopLink) {
+      if (!lk->receivePacket(&p)) {
+        p->link = index + 1;
+        crtpCountRx(p->port, p->size + 1);
+        /*! Callbacks only borrow the packet, so run them before handing it over */
+        CrtpCallback volatile *subscribers = callbacks[p->port][p->channel];
+        for (int i = 0; i < CRTP_MAX_SUBSCRIBERS; i++) {
+          /*! Read the slot once, crtpUnsubscribe may clear it meanwhile */
+          CrtpCallback cb = subscribers[i];
+          if (cb)
+            cb(p);
+        }
+
+        /*! The port consumer owns it from now on */
+        if (queues[p->port])
+          crtpRxEnqueue(p);
+        else
+          crtpPoolFree(p);
       }
     } else
 			osDelay(10);
   }
 }
 
+void crtpRegisterFastPath(CRTPPort port, uint8_t channel, CrtpFastCallback cb) {
+  ASSERT(port < CRTP_NBR_OF_PORTS);
+  ASSERT(channel < CRTP_NBR_OF_CHANNELS);
+  fastPaths[port][channel] = cb;
+}
+
+bool crtpDispatchFast(const uint8_t *raw, uint8_t length, uint32_t rxStamp) {
+  CrtpFastCallback cb;
+  CRTPPacket p = CRTP_PACKET_INIT(0, 0);
+
+  if (length < 1 || length > CRTP_MAX_DATA_SIZE + 1)
+    return false;
+  cb = fastPaths[raw[0] >> 4][raw[0] & 0x03];
+  if (cb == NULL)
+    return false;
+
+  p.size = length - 1;
+  memcpy(p.raw, raw, length);
+  crtpCountRx(p.port, length);
+  cb(&p, rxStamp);
+  return true;
+}
+
+void crtpSetPortRoute(CRTPPort port, uint8_t linkMask) {
+  ASSERT(port < CRTP_NBR_OF_PORTS);
+  portRoute[port] = linkMask & CRTP_LINK_ALL;
+}
+
 void crtpRegisterPortCB(int port, CrtpCallback cb) {
-  if (port > CRTP_NBR_OF_PORTS)
+  if (port < 0 || port >= CRTP_NBR_OF_PORTS)
     return;
 
-  callbacks[port] = cb;
+  for (int channel = 0; channel < CRTP_NBR_OF_CHANNELS; channel++) {
+    int status = crtpSubscribe(port, channel, cb);
+    ASSERT(status == 0);
+  }
 }
 
-int crtpSendPacket(CRTPPacket *p) {
+int crtpSubscribe(CRTPPort port, uint8_t channel, CrtpCallback cb) {
+  CrtpCallback volatile *subscribers;
+  int status = -1;
+
+  ASSERT(port < CRTP_NBR_OF_PORTS);
+  ASSERT(channel < CRTP_NBR_OF_CHANNELS);
+  ASSERT(cb);
+
+  subscribers = callbacks[port][channel];
+  taskENTER_CRITICAL();
+  for (int i = 0; i < CRTP_MAX_SUBSCRIBERS; i++) {
+    if (subscribers[i] == NULL) {
+      subscribers[i] = cb;
+      status = 0;
+      break;
+    }
+  }
+  taskEXIT_CRITICAL();
+
+  return status;
+}
+
+void crtpUnsubscribe(CRTPPort port, uint8_t channel, CrtpCallback cb) {
+  CrtpCallback volatile *subscribers;
+  int i;
+
+  ASSERT(port < CRTP_NBR_OF_PORTS);
+  ASSERT(channel < CRTP_NBR_OF_CHANNELS);
+
+  subscribers = callbacks[port][channel];
+  taskENTER_CRITICAL();
+  /*! Clear the slot in place, moving the others would let a running crtpRxTask skip or repeat one */
+  for (i = 0; i < CRTP_MAX_SUBSCRIBERS; i++) {
+    if (subscribers[i] == cb) {
+      subscribers[i] = NULL;
+      break;
+    }
+  }
+  taskEXIT_CRITICAL();
+}
+
+static int crtpTxEnqueue(CRTPPacket *p, CrtpTxLane lane, uint32_t timeout) {
+  int status;
+  uint32_t count;
+
+  ASSERT(lane < CRTP_TX_LANE_COUNT);
+
+  status = osMessageQueuePut(txQueues[lane], &p, 0, timeout);
+  if (status != osOK) {
+    txDropped[lane]++;
+    txPortDropped[p->port]++;
+    crtpPoolFree(p);
+    return status;
+  }
+
+  count = osMessageQueueGetCount(txQueues[lane]);
+  if (count > txHighWater[lane])
+    txHighWater[lane] = count;
+  osSemaphoreRelease(txPending);
+
+  return status;
+}
+
+int crtpSendPacketRef(CRTPPacket *p) {
+  ASSERT(p);
+  ASSERT(p->size <= CRTP_MAX_DATA_SIZE);
+  ASSERT(p->link <= CRTP_MAX_LINKS);
+
+  return crtpTxEnqueue(p, portLane[p->port], 0);
+}
+
+int crtpSendPacketLane(CRTPPacket *p, CrtpTxLane lane) {
+  CRTPPacket *pk;
+
   ASSERT(p);
   ASSERT(p->size <= CRTP_MAX_DATA_SIZE);
+  ASSERT(p->link <= CRTP_MAX_LINKS);
+  ASSERT(lane < CRTP_TX_LANE_COUNT);
+
+  pk = crtpPoolAllocTx();
+  if (pk == NULL) {
+    txDropped[lane]++;
+    txPortDropped[p->port]++;
+    return osErrorResource;
+  }
+  *pk = *p;
 
-  return osMessageQueuePut(txQueue, p, 0, 0);
+  return crtpTxEnqueue(pk, lane, 0);
+}
+
+int crtpSendPacket(CRTPPacket *p) {
+  ASSERT(p);
+  return crtpSendPacketLane(p, portLane[p->port]);
 }
 
 int crtpSendPacketBlock(CRTPPacket *p) {
+  CRTPPacket *pk;
+
   ASSERT(p);
   ASSERT(p->size <= CRTP_MAX_DATA_SIZE);
+  ASSERT(p->link <= CRTP_MAX_LINKS);
 
-  return osMessageQueuePut(txQueue, p, 0, osWaitForever);
+  /*! The pool has no wait primitive, a full TX path drains within a few ticks */
+  while ((pk = crtpPoolAllocTx()) == NULL)
+    osDelay(1);
+  *pk = *p;
+
+  return crtpTxEnqueue(pk, portLane[p->port], osWaitForever);
 }
 
 int crtpReset(void) {
-  osMessageQueueReset(txQueue);
-  if (link->reset) {
-    link->reset();
+  CRTPPacket *p;
+
+  /*! txPending may count packets dropped here, the TX task tolerates waking up to empty lanes */
+  while (crtpTxDequeue(&p))
+    crtpPoolFree(p);
+  for (int i = 0; i < CRTP_MAX_LINKS; i++) {
+    if (links[i]->reset)
+      links[i]->reset();
   }
 
   return 0;
 }
 
 bool crtpIsConnected(void) {
-  if (link->isConnected)
-    return link->isConnected();
-  return true;
+  return crtpConnectedLinks() != 0;
 }
 
 void crtpSetLink(struct crtpLinkOperations * lk) {
-  if (link)
-    link->setEnable(false);
+  for (int i = 0; i < CRTP_MAX_LINKS; i++) {
+    links[i]->setEnable(false);
+    links[i] = &nopLink;
+  }
 
   if (lk)
-    link = lk;
-  else
-    link = &nopLink;
+    links[0] = lk;
 
-  link->setEnable(true);
+  links[0]->setEnable(true);
+}
+
+int crtpAddLink(struct crtpLinkOperations * lk) {
+  ASSERT(lk);
+
+  for (int i = 0; i < CRTP_MAX_LINKS; i++) {
+    if (links[i] == &nopLink) {
+      links[i] = lk;
+      lk->setEnable(true);
+      return i;
+    }
+  }
+  return -1;
 }
 
 static int nopFunc(void) {
@@ -0,0 +1,90 @@
+#include <stddef.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "crtp_pool.h"
+#include "static_mem.h"
+#include "cfassert.h"
+
+static bool isInit = false;
+
+NO_DMA_CCM_SAFE_ZERO_INIT static CRTPPacket pool[CRTP_POOL_SIZE];
+static CRTPPacket *freeList[CRTP_POOL_SIZE];
+static uint32_t timestamps[CRTP_POOL_SIZE];
+static int freeCount;
+static int minFree;
+static uint32_t allocs;
+static uint32_t failures;
+
+void crtpPoolInit(void) {
+  if (isInit)
+    return;
+
+  for (int i = 0; i < CRTP_POOL_SIZE; i++)
+    freeList[i] = &pool[i];
+  freeCount = CRTP_POOL_SIZE;
+  minFree = CRTP_POOL_SIZE;
+
+  isInit = true;
+}
+
+/*! Interrupt safe, the critical section only masks up to the syscall priority */
+static CRTPPacket *poolTake(int reserve) {
+  CRTPPacket *p = NULL;
+  UBaseType_t mask = taskENTER_CRITICAL_FROM_ISR();
+
+  if (freeCount > reserve) {
+    p = freeList[--freeCount];
+    /*! Whatever the previous owner left, a new packet follows its port route */
+    p->link = CRTP_LINK_ROUTE;
+    timestamps[p - pool] = 0;
+    allocs++;
+    if (freeCount < minFree)
+      minFree = freeCount;
+  } else {
+    failures++;
+  }
+
+  taskEXIT_CRITICAL_FROM_ISR(mask);
+  return p;
+}
+
+CRTPPacket *crtpPoolAlloc(void) {
+  return poolTake(0);
+}
+
+CRTPPacket *crtpPoolAllocTx(void) {
+  return poolTake(CRTP_POOL_RX_RESERVE);
+}
+
+void crtpPoolFree(CRTPPacket *p) {
+  if (p == NULL)
+    return;
+
+  ASSERT(p >= &pool[0] && p < &pool[CRTP_POOL_SIZE]);
+
+  UBaseType_t mask = taskENTER_CRITICAL_FROM_ISR();
+  ASSERT(freeCount < CRTP_POOL_SIZE);
+  freeList[freeCount++] = p;
+  taskEXIT_CRITICAL_FROM_ISR(mask);
+}
+
+void crtpPoolSetTimestamp(CRTPPacket *p, uint32_t stamp) {
+  ASSERT(p >= &pool[0] && p < &pool[CRTP_POOL_SIZE]);
+  timestamps[p - pool] = stamp;
+}
+
+uint32_t crtpPoolGetTimestamp(const CRTPPacket *p) {
+  ASSERT(p >= &pool[0] && p < &pool[CRTP_POOL_SIZE]);
+  return timestamps[p - pool];
+}
+
+void crtpPoolGetStats(CrtpPoolStats *stats) {
+  UBaseType_t mask = taskENTER_CRITICAL_FROM_ISR();
+  stats->allocs = allocs;
+  stats->failures = failures;
+  stats->free = freeCount;
+  stats->minFree = minFree;
+  taskEXIT_CRITICAL_FROM_ISR(mask);
+}
@@ -0,0 +1,234 @@
+#include <string.h>
+
+#include "config.h"
+#include "crtp.h"
+#include "crtpservice.h"
+#include "static_mem.h"
+#include "controller.h"
+#include "histogram.h"
+#include "crtp_pool.h"
+#include "usblink.h"
+#include "cyclecounter.h"
+#include "car_driver.h"
+
+static bool isInit = false;
+
+STATIC_MEM_TASK_ALLOC(crtpSrvTask, CRTP_SRV_TASK_STACKSIZE);
+static void crtpSrvTask(void *param);
+
+void crtpserviceInit(void) {
+  if (isInit)
+    return;
+
+  /*! Queries are cheap to repeat, never let them hold up reception */
+  crtpInitTaskQueuePolicy(CRTP_PORT_LINK, CRTP_QUEUE_DROP_NEWEST);
+  STATIC_MEM_TASK_CREATE(crtpSrvTask, crtpSrvTask, CRTP_SRV_TASK_NAME, NULL, CRTP_SRV_TASK_PRI);
+
+  isInit = true;
+}
+
+bool crtpserviceTest(void) {
+  return isInit;
+}
+
+static bool crtpSrvGetHistogram(uint8_t id, Histogram *h) {
+  Histogram unused;
+
+  if (id < LATENCY_STAGE_COUNT) {
+    latencyGet(id, h);
+    return true;
+  }
+
+  switch (id) {
+    case CRTP_SRV_HIST_CONTROLLER_JITTER:
+      controllerGetTiming(h, &unused);
+      return true;
+    case CRTP_SRV_HIST_CONTROLLER_EXEC:
+      controllerGetTiming(&unused, h);
+      return true;
+    default:
+      return false;
+  }
+}
+
+static void crtpSrvSendHistogram(CRTPPacket *p, uint8_t id) {
+  CrtpSrvHistogramSummary summary;
+  CrtpSrvHistogramBins bins;
+  Histogram h;
+  int n;
+
+  if (!crtpSrvGetHistogram(id, &h))
+    return;
+
+  summary.command = CRTP_SRV_STATS_HISTOGRAM;
+  summary.id = id;
+  summary.binWidth = h.binWidth;
+  summary.count = h.count;
+  summary.min = h.min;
+  summary.max = h.max;
+  summary.mean = histogramMean(&h);
+  memcpy(p->data, &summary, sizeof(summary));
+  p->size = sizeof(summary);
+  crtpSendPacketBlock(p);
+
+  bins.command = CRTP_SRV_STATS_HISTOGRAM_BINS;
+  bins.id = id;
+  for (int first = 0; first < HISTOGRAM_BINS; first += n) {
+    n = HISTOGRAM_BINS - first;
+    if (n > CRTP_SRV_BINS_PER_PACKET)
+      n = CRTP_SRV_BINS_PER_PACKET;
+    bins.first = first;
+    memcpy(bins.bins, &h.bins[first], n * sizeof(uint32_t));
+    memcpy(p->data, &bins, sizeof(bins));
+    p->size = sizeof(bins) - (CRTP_SRV_BINS_PER_PACKET - n) * sizeof(uint32_t);
+    crtpSendPacketBlock(p);
+  }
+}
+
+static void crtpSrvResetHistogram(CRTPPacket *p, uint8_t id) {
+  if (id < LATENCY_STAGE_COUNT)
+    latencyReset(id);
+  else if (id < CRTP_SRV_HIST_COUNT)
+    controllerResetTiming();
+  else
+    return;
+
+  p->size = 2;
+  crtpSendPacketBlock(p);
+}
+
+static void crtpSrvSendPortStats(CRTPPacket *p, uint8_t port) {
+  CrtpSrvPortStats reply;
+  CrtpPortStats stats;
+
+  if (port > CRTP_PORT_LINK)
+    return;
+
+  crtpGetPortStats(port, &stats);
+  reply.command = CRTP_SRV_STATS_PORT;
+  reply.port = port;
+  reply.rxPackets = stats.rxPackets;
+  reply.rxBytes = stats.rxBytes;
+  reply.rxDropped = stats.rxDropped;
+  reply.txPackets = stats.txPackets;
+  reply.txBytes = stats.txBytes;
+  reply.txDropped = stats.txDropped;
+  reply.rxHighWater = stats.rxHighWater;
+  memcpy(p->data, &reply, sizeof(reply));
+  p->size = sizeof(reply);
+  crtpSendPacketBlock(p);
+}
+
+static void crtpSrvSendLinkStats(CRTPPacket *p) {
+  CrtpSrvLinkStats reply;
+  CrtpTxLaneStats lane;
+  CrtpPoolStats pool;
+  UsblinkStats usb;
+
+  reply.command = CRTP_SRV_STATS_LINK;
+  for (int i = 0; i < CRTP_TX_LANE_COUNT; i++) {
+    crtpGetTxLaneStats(i, &lane);
+    reply.txHighWater[i] = lane.highWater;
+  }
+  usblinkGetStats(&usb);
+  crtpPoolGetStats(&pool);
+  reply.deliveryHighWater = usb.rxHighWater;
+  reply.poolMinFree = pool.minFree;
+  reply.linkRetries = crtpGetLinkRetries();
+  reply.linkWaits = usb.txWaits;
+  reply.usbRxDropped = usb.rxDropped;
+  reply.usbRxErrors = usb.rxErrors;
+  memcpy(p->data, &reply, sizeof(reply));
+  p->size = sizeof(reply);
+  crtpSendPacketBlock(p);
+}
+
+static void crtpSrvPing(CRTPPacket *p) {
+  CrtpSrvPing reply = { .command = CRTP_SRV_STATS_PING };
+  uint8_t len = p->size - 1;
+
+  reply.tick = osKernelGetTickCount();
+  reply.cycles = cycleCounterGet();
+  if (len > CRTP_SRV_PING_DATA_SIZE)
+    len = CRTP_SRV_PING_DATA_SIZE;
+  memcpy(reply.data, &p->data[1], len);
+  memcpy(p->data, &reply, sizeof(reply));
+  p->size = sizeof(reply) - CRTP_SRV_PING_DATA_SIZE + len;
+  crtpSendPacketBlock(p);
+}
+
+static void crtpSrvMotorBench(CRTPPacket *p) {
+  CrtpSrvMotorBench reply = { .command = CRTP_SRV_STATS_MOTOR_BENCH };
+  CarBenchmark bench;
+  uint16_t samples;
+
+  memcpy(&samples, &p->data[1], sizeof(samples));
+  carBenchmark(samples, &bench);
+  reply.samples = bench.samples;
+  reply.floatCycles = bench.floatCycles;
+  reply.fixedCycles = bench.fixedCycles;
+  reply.commandMismatches = bench.commandMismatches;
+  reply.saturationMismatches = bench.saturationMismatches;
+  reply.compareMismatches = bench.compareMismatches;
+  reply.maxCommandError = bench.maxCommandError;
+  memcpy(p->data, &reply, sizeof(reply));
+  p->size = sizeof(reply);
+  crtpSendPacketBlock(p);
+}
+
+static void crtpSrvStats(CRTPPacket *p) {
+  if (p->size < 1)
+    return;
+
+  switch (p->data[0]) {
+    case CRTP_SRV_STATS_LINK:
+      crtpSrvSendLinkStats(p);
+      return;
+    case CRTP_SRV_STATS_PING:
+      crtpSrvPing(p);
+      return;
+    default:
+      break;
+  }
+
+  /*! The remaining commands take an argument */
+  if (p->size < 2)
+    return;
+
+  switch (p->data[0]) {
+    case CRTP_SRV_STATS_PORT:
+      crtpSrvSendPortStats(p, p->data[1]);
+      break;
+    case CRTP_SRV_STATS_HISTOGRAM:
+      crtpSrvSendHistogram(p, p->data[1]);
+      break;
+    case CRTP_SRV_STATS_HISTOGRAM_RESET:
+      crtpSrvResetHistogram(p, p->data[1]);
+      break;
+    case CRTP_SRV_STATS_MOTOR_BENCH:
+      if (p->size >= 3)
+        crtpSrvMotorBench(p);
+      break;
+    default:
+      break;
+  }
+}
+
+static void crtpSrvTask(void *param) {
+  static CRTPPacket p;
+
+  while (1) {
+    crtpReceivePacketBlock(CRTP_PORT_LINK, &p);
+
+    switch (p.channel) {
+      case CRTP_SRV_LINK_ECHO:
+        crtpSendPacketBlock(&p);
+        break;
+      case CRTP_SRV_LINK_STATS:
+        crtpSrvStats(&p);
+        break;
+      default:
+        break;
+    }
+  }
+}
@@ -0,0 +1,20 @@
+#include "cyclecounter.h"
+#include "main.h"
+
+void cycleCounterInit(void) {
+  CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+  DWT->CYCCNT = 0;
+  DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+uint32_t cycleCounterGet(void) {
+  return DWT->CYCCNT;
+}
+
+uint32_t cycleCounterToUs(uint32_t cycles) {
+  return cycles / (SystemCoreClock / 1000000);
+}
+
+uint32_t cycleCounterFromUs(uint32_t us) {
+  return us * (SystemCoreClock / 1000000);
+}
@@ -32,7 +32,9 @@
 #include <ctype.h>
 
 int debugUartPutchar(int c) {
+#ifndef CRTP_LINK_UART
   HAL_UART_Transmit(&debugUart, (uint8_t*) &c, 1, 100);
+#endif
   return (unsigned char) c;
 }
 
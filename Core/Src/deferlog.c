@@ -0,0 +1,125 @@
+#include <ctype.h>
+#include <string.h>
+
+#include "config.h"
+#include "deferlog.h"
+#include "static_mem.h"
+#include "task.h"
+
+#define DEFERLOG_ENTRIES 32   // Must be a power of two
+#define DEFERLOG_SPEC_MAX 8
+
+typedef struct {
+  const char *fmt;
+  uint32_t timestamp;
+  uint32_t nargs;
+  uintptr_t args[DEFERLOG_MAX_ARGS];
+} DeferlogEntry;
+
+static bool isInit = false;
+static DeferlogEntry entries[DEFERLOG_ENTRIES];
+static uint32_t head;   // written by the producers, inside a critical section
+static uint32_t tail;   // written by deferlogTask only
+static uint32_t dropped;
+
+STATIC_MEM_TASK_ALLOC(deferlogTask, DEFERLOG_TASK_STACKSIZE);
+static void deferlogTask(void *param);
+
+void deferlogInit(void) {
+  if (isInit)
+    return;
+
+  STATIC_MEM_TASK_CREATE(deferlogTask, deferlogTask, DEFERLOG_TASK_NAME, NULL, DEFERLOG_TASK_PRI);
+  isInit = true;
+}
+
+bool deferlogTest(void) {
+  return isInit;
+}
+
+void deferlogWrite(const char *fmt, uint32_t nargs, const uintptr_t *args) {
+  UBaseType_t mask = taskENTER_CRITICAL_FROM_ISR();
+
+  if (head - __atomic_load_n(&tail, __ATOMIC_ACQUIRE) < DEFERLOG_ENTRIES) {
+    DeferlogEntry *e = &entries[head & (DEFERLOG_ENTRIES - 1)];
+    e->fmt = fmt;
+    e->timestamp = xTaskGetTickCountFromISR();
+    e->nargs = nargs;
+    memcpy(e->args, args, nargs * sizeof(uintptr_t));
+    head++;
+  } else {
+    dropped++;
+  }
+
+  taskEXIT_CRITICAL_FROM_ISR(mask);
+}
+
+void deferlogGetStats(DeferlogStats *stats) {
+  UBaseType_t mask = taskENTER_CRITICAL_FROM_ISR();
+  stats->written = head + dropped;
+  stats->dropped = dropped;
+  taskEXIT_CRITICAL_FROM_ISR(mask);
+}
+
+/* Prints one entry, handing each conversion with its stored argument to eprintf */
+static void deferlogFormat(putc_t putcf, const DeferlogEntry *e) {
+  const char *fmt = e->fmt;
+  char spec[DEFERLOG_SPEC_MAX + 2];
+  uint32_t arg = 0;
+  uintptr_t word;
+  int len;
+  union { uint32_t u; float f; } v;
+
+  eprintf(putcf, "[%u] ", (unsigned int)e->timestamp);
+
+  while (*fmt) {
+    if (*fmt != '%') {
+      putcf(*fmt++);
+      continue;
+    }
+
+    len = 0;
+    spec[len++] = *fmt++;
+    while (*fmt && !isalpha((unsigned)*fmt) && *fmt != '%' && len < DEFERLOG_SPEC_MAX)
+      spec[len++] = *fmt++;
+    while (*fmt == 'l' && len < DEFERLOG_SPEC_MAX)
+      fmt++;
+    if (*fmt == '\0')
+      break;
+    if (*fmt == '%') {
+      putcf(*fmt++);
+      continue;
+    }
+    spec[len++] = *fmt;
+    spec[len] = '\0';
+
+    word = (arg < e->nargs) ? e->args[arg] : 0;
+    v.u = word;
+    arg++;
+    switch (*fmt++) {
+      case 'f':
+        eprintf(putcf, spec, (double)v.f);
+        break;
+      case 's':
+        eprintf(putcf, spec, (const char *)word);
+        break;
+      default:
+        eprintf(putcf, spec, (int)v.u);
+        break;
+    }
+  }
+}
+
+static void deferlogTask(void *param) {
+  DeferlogEntry e;
+
+  while (1) {
+    /* Polling keeps the producers free of any kernel call */
+    while (tail != __atomic_load_n(&head, __ATOMIC_ACQUIRE)) {
+      e = entries[tail & (DEFERLOG_ENTRIES - 1)];
+      __atomic_store_n(&tail, tail + 1, __ATOMIC_RELEASE);
+      deferlogFormat(debugUartPutchar, &e);
+    }
+    osDelay(10);
+  }
+}
@@ -0,0 +1,27 @@
+#include <string.h>
+
+#include "histogram.h"
+
+void histogramInit(Histogram *h, uint32_t binWidth) {
+  memset(h, 0, sizeof(*h));
+  h->binWidth = binWidth;
+  h->min = UINT32_MAX;
+}
+
+void histogramAdd(Histogram *h, uint32_t value) {
+  uint32_t bin = value / h->binWidth;
+
+  if (bin >= HISTOGRAM_BINS)
+    bin = HISTOGRAM_BINS - 1;
+  h->bins[bin]++;
+  h->count++;
+  h->sum += value;
+  if (value < h->min)
+    h->min = value;
+  if (value > h->max)
+    h->max = value;
+}
+
+uint32_t histogramMean(const Histogram *h) {
+  return h->count ? h->sum / h->count : 0;
+}
@@ -0,0 +1,44 @@
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "latency.h"
+#include "cyclecounter.h"
+
+/*! Bin width of each stage in us, the 16 bins should cover its normal range */
+static const uint32_t binWidth[LATENCY_STAGE_COUNT] = {
+  [LATENCY_USB_TO_DISPATCH]        = 20,
+  [LATENCY_DISPATCH_TO_CONTROLLER] = 200,
+  [LATENCY_CONTROLLER_TO_PWM]      = 2,
+  [LATENCY_TOTAL]                  = 250,
+};
+
+static Histogram stages[LATENCY_STAGE_COUNT];
+
+void latencyInit(void) {
+  for (int i = 0; i < LATENCY_STAGE_COUNT; i++)
+    histogramInit(&stages[i], binWidth[i]);
+}
+
+void latencyRecord(LatencyStage stage, uint32_t from, uint32_t to) {
+  uint32_t us;
+
+  if (from == 0)
+    return;
+
+  us = cycleCounterToUs(to - from);
+  UBaseType_t mask = taskENTER_CRITICAL_FROM_ISR();
+  histogramAdd(&stages[stage], us);
+  taskEXIT_CRITICAL_FROM_ISR(mask);
+}
+
+void latencyGet(LatencyStage stage, Histogram *h) {
+  UBaseType_t mask = taskENTER_CRITICAL_FROM_ISR();
+  *h = stages[stage];
+  taskEXIT_CRITICAL_FROM_ISR(mask);
+}
+
+void latencyReset(LatencyStage stage) {
+  UBaseType_t mask = taskENTER_CRITICAL_FROM_ISR();
+  histogramInit(&stages[stage], binWidth[stage]);
+  taskEXIT_CRITICAL_FROM_ISR(mask);
+}
@@ -0,0 +1,260 @@
+#include <stddef.h>
+#include <string.h>
+
+#include "FreeRTOS.h"
+#include "cmsis_os2.h"
+
+#include "config.h"
+#include "motorcal.h"
+#include "crtp.h"
+#include "static_mem.h"
+
+/*! Motion starts where the response has risen by this fraction of its range */
+#define MOTORCAL_DEADBAND_DIVISOR 50
+
+static bool isInit = false;
+/*! Tables being written by the host, copied to the motors by MOTORCAL_CMD_APPLY */
+static MotorLut editLut[MOTOR_NBR][2];
+
+STATIC_MEM_TASK_ALLOC(motorcalTask, MOTORCAL_TASK_STACKSIZE);
+static void motorcalTask(void *param);
+
+void motorcalInit(void) {
+  if (isInit)
+    return;
+
+  for (int i = 0; i < MOTOR_NBR; i++) {
+    motorGetLut(i, false, &editLut[i][0]);
+    motorGetLut(i, true, &editLut[i][1]);
+  }
+  crtpInitTaskQueue(CRTP_PORT_MEM);
+  STATIC_MEM_TASK_CREATE(motorcalTask, motorcalTask, MOTORCAL_TASK_NAME, NULL, MOTORCAL_TASK_PRI);
+
+  isInit = true;
+}
+
+bool motorcalTest(void) {
+  return isInit;
+}
+
+static void motorcalReply(CRTPPacket *p, MotorcalStatus status) {
+  p->data[1] = status;
+  p->size = 2;
+  crtpSendPacketBlock(p);
+}
+
+static void motorcalRead(CRTPPacket *p) {
+  MotorcalChunk chunk;
+  MotorLut lut;
+  int n;
+
+  if (p->size != offsetof(MotorcalChunk, points)) {
+    motorcalReply(p, MOTORCAL_ERROR_LENGTH);
+    return;
+  }
+  memcpy(&chunk, p->data, offsetof(MotorcalChunk, points));
+  if (chunk.motor >= MOTOR_NBR || chunk.direction > 1 || chunk.first >= MOTOR_LUT_POINTS) {
+    motorcalReply(p, MOTORCAL_ERROR_INDEX);
+    return;
+  }
+
+  motorGetLut(chunk.motor, chunk.direction, &lut);
+  n = MOTOR_LUT_POINTS - chunk.first;
+  if (n > MOTORCAL_CHUNK_POINTS)
+    n = MOTORCAL_CHUNK_POINTS;
+  chunk.status = MOTORCAL_OK;
+  memcpy(chunk.points, &lut.point[chunk.first], n * sizeof(uint16_t));
+  memcpy(p->data, &chunk, sizeof(chunk));
+  p->size = sizeof(chunk) - (MOTORCAL_CHUNK_POINTS - n) * sizeof(uint16_t);
+  crtpSendPacketBlock(p);
+}
+
+static MotorcalStatus motorcalWrite(const CRTPPacket *p) {
+  MotorcalChunk chunk;
+  int n;
+
+  if (p->size < offsetof(MotorcalChunk, points) || (p->size - offsetof(MotorcalChunk, points)) % sizeof(uint16_t))
+    return MOTORCAL_ERROR_LENGTH;
+  n = (p->size - offsetof(MotorcalChunk, points)) / sizeof(uint16_t);
+  if (n > MOTORCAL_CHUNK_POINTS)
+    return MOTORCAL_ERROR_LENGTH;
+  memcpy(&chunk, p->data, p->size);
+  if (chunk.motor >= MOTOR_NBR || chunk.direction > 1 || chunk.first + n > MOTOR_LUT_POINTS)
+    return MOTORCAL_ERROR_INDEX;
+
+  memcpy(&editLut[chunk.motor][chunk.direction].point[chunk.first], chunk.points, n * sizeof(uint16_t));
+  return MOTORCAL_OK;
+}
+
+static MotorcalStatus motorcalApply(const CRTPPacket *p) {
+  uint8_t motor, direction;
+
+  if (p->size != 3)
+    return MOTORCAL_ERROR_LENGTH;
+  motor = p->data[1];
+  direction = p->data[2];
+  if (motor >= MOTOR_NBR || direction > 1)
+    return MOTORCAL_ERROR_INDEX;
+  return motorSetLut(motor, direction, &editLut[motor][direction]) ? MOTORCAL_OK : MOTORCAL_ERROR_TABLE;
+}
+
+static MotorcalStatus motorcalReset(void) {
+  motorResetLut();
+  for (int i = 0; i < MOTOR_NBR; i++) {
+    motorGetLut(i, false, &editLut[i][0]);
+    motorGetLut(i, true, &editLut[i][1]);
+  }
+  return MOTORCAL_OK;
+}
+
+/**
+ * Send one sample and wait for the host to send it back with the response.
+ * Other commands are refused meanwhile, except MOTORCAL_CMD_ABORT.
+ */
+static MotorcalStatus motorcalSample(const CRTPPacket *request, uint8_t step, uint16_t output, int32_t *response) {
+  MotorcalSample sample = { .command = MOTORCAL_CMD_SAMPLE, .step = step, .output = output };
+  uint32_t deadline = osKernelGetTickCount() + MOTORCAL_RESPONSE_TIMEOUT_MS * osKernelGetTickFreq() / 1000;
+  /*! Header and link of the request, so the samples go back the way it came */
+  CRTPPacket p = *request;
+
+  memcpy(p.data, &sample, sizeof(sample));
+  p.size = sizeof(sample);
+  crtpSendPacketBlock(&p);
+
+  while ((int32_t)(deadline - osKernelGetTickCount()) > 0 && crtpIsConnected()) {
+    if (motorIsOverrideAborted())
+      return MOTORCAL_ERROR_ABORTED;
+    if (crtpReceivePacketWait(CRTP_PORT_MEM, &p, 100) != osOK)
+      continue;
+    if (p.channel != 0 || p.size < 1)
+      continue;
+    switch (p.data[0]) {
+      case MOTORCAL_CMD_SAMPLE:
+        if (p.size != sizeof(sample))
+          break;
+        memcpy(&sample, p.data, sizeof(sample));
+        if (sample.step != step)
+          break;
+        *response = sample.response;
+        return MOTORCAL_OK;
+      case MOTORCAL_CMD_ABORT:
+        motorcalReply(&p, MOTORCAL_OK);
+        return MOTORCAL_ERROR_ABORTED;
+      default:
+        motorcalReply(&p, MOTORCAL_ERROR_BUSY);
+        break;
+    }
+  }
+  return MOTORCAL_ERROR_TIMEOUT;
+}
+
+/**
+ * Invert the measured curve: point i is the output at which the response
+ * reaches i / (MOTOR_LUT_POINTS - 1) of the way from the end of the deadband
+ * to the top, interpolated between the two samples around it.
+ */
+static MotorcalStatus motorcalBuildLut(const uint16_t *output, int32_t *response, int steps, MotorLut *lut) {
+  int32_t top, threshold;
+  int k = 0;
+
+  /*! More output never slows a motor down, flatten the measurement noise */
+  for (int i = 1; i < steps; i++) {
+    if (response[i] < response[i - 1])
+      response[i] = response[i - 1];
+  }
+  top = response[steps - 1];
+  if (top <= response[0])
+    return MOTORCAL_ERROR_RESPONSE;
+  threshold = response[0] + (top - response[0] + MOTORCAL_DEADBAND_DIVISOR - 1) / MOTORCAL_DEADBAND_DIVISOR;
+
+  for (int i = 0; i < MOTOR_LUT_POINTS; i++) {
+    int64_t target = threshold + (int64_t)(top - threshold) * i / (MOTOR_LUT_POINTS - 1);
+
+    while (response[k] < target)
+      k++;
+    if (k == 0) {
+      lut->point[i] = output[0];
+      continue;
+    }
+    lut->point[i] = output[k - 1] + (output[k] - output[k - 1]) * (target - response[k - 1]) /
+                                    (response[k] - response[k - 1]);
+  }
+  return MOTORCAL_OK;
+}
+
+static MotorcalStatus motorcalSweep(const CRTPPacket *p) {
+  uint16_t output[MOTORCAL_SWEEP_MAX_STEPS];
+  int32_t response[MOTORCAL_SWEEP_MAX_STEPS];
+  MotorcalStatus status = MOTORCAL_OK;
+  MotorcalSweep sweep;
+  MotorLut lut;
+
+  if (p->size != sizeof(sweep))
+    return MOTORCAL_ERROR_LENGTH;
+  memcpy(&sweep, p->data, sizeof(sweep));
+  if (sweep.motor >= MOTOR_NBR || sweep.direction > 1 || sweep.steps < 3 || sweep.steps > MOTORCAL_SWEEP_MAX_STEPS)
+    return MOTORCAL_ERROR_INDEX;
+
+  /*!
+   * The override holds the other motors at 0 whatever the controller commands.
+   * A stop, a setpoint or a setpoint timeout aborts it, the sweep ends there.
+   */
+  for (int i = 0; i < sweep.steps && status == MOTORCAL_OK; i++) {
+    output[i] = (uint32_t)i * (MOTOR_MAX_THRUST - 1) / (sweep.steps - 1);
+    if (!motorSetOverride(sweep.motor, sweep.direction ? -output[i] : output[i])) {
+      status = MOTORCAL_ERROR_ABORTED;
+      break;
+    }
+    motorCommit();
+    osDelay(sweep.settle * osKernelGetTickFreq() / 1000);
+    status = motorcalSample(p, i, output[i], &response[i]);
+  }
+  motorSetOverride(-1, 0);
+  motorCommit();
+
+  if (status == MOTORCAL_OK)
+    status = motorcalBuildLut(output, response, sweep.steps, &lut);
+  if (status == MOTORCAL_OK && !motorSetLut(sweep.motor, sweep.direction, &lut))
+    status = MOTORCAL_ERROR_TABLE;
+  if (status == MOTORCAL_OK)
+    editLut[sweep.motor][sweep.direction] = lut;
+  return status;
+}
+
+static void motorcalTask(void *param) {
+  static CRTPPacket p;
+
+  while (1) {
+    crtpReceivePacketBlock(CRTP_PORT_MEM, &p);
+
+    if (p.channel != 0 || p.size < 1)
+      continue;
+
+    switch (p.data[0]) {
+      case MOTORCAL_CMD_READ:
+        motorcalRead(&p);
+        break;
+      case MOTORCAL_CMD_WRITE:
+        motorcalReply(&p, motorcalWrite(&p));
+        break;
+      case MOTORCAL_CMD_APPLY:
+        motorcalReply(&p, motorcalApply(&p));
+        break;
+      case MOTORCAL_CMD_RESET:
+        motorcalReply(&p, motorcalReset());
+        break;
+      case MOTORCAL_CMD_SWEEP:
+        motorcalReply(&p, motorcalSweep(&p));
+        break;
+      /*! Late answers of an ended sweep */
+      case MOTORCAL_CMD_SAMPLE:
+        break;
+      case MOTORCAL_CMD_ABORT:
+        motorcalReply(&p, MOTORCAL_OK);
+        break;
+      default:
+        motorcalReply(&p, MOTORCAL_ERROR_COMMAND);
+        break;
+    }
+  }
+}
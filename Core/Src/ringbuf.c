@@ -0,0 +1,69 @@
+#include <string.h>
+
+#include "ringbuf.h"
+
+/*! Acquire/release ordering is all a single core needs between an ISR and a task */
+#define LOAD_ACQUIRE(X)     __atomic_load_n(&(X), __ATOMIC_ACQUIRE)
+#define STORE_RELEASE(X, V) __atomic_store_n(&(X), (V), __ATOMIC_RELEASE)
+
+void ringBufferInit(RingBuffer *rb, uint8_t *buffer, uint32_t size) {
+  rb->buffer = buffer;
+  rb->mask = size - 1;
+  rb->head = 0;
+  rb->tail = 0;
+}
+
+uint32_t ringBufferUsed(const RingBuffer *rb) {
+  return LOAD_ACQUIRE(rb->head) - LOAD_ACQUIRE(rb->tail);
+}
+
+uint32_t ringBufferFree(const RingBuffer *rb) {
+  return rb->mask + 1 - ringBufferUsed(rb);
+}
+
+bool ringBufferWrite(RingBuffer *rb, const uint8_t *data, uint32_t len) {
+  uint32_t head = rb->head;
+  uint32_t tail = LOAD_ACQUIRE(rb->tail);
+  uint32_t size = rb->mask + 1;
+
+  if (size - (head - tail) < len)
+    return false;
+
+  uint32_t start = head & rb->mask;
+  uint32_t first = size - start;
+  if (first > len)
+    first = len;
+  memcpy(&rb->buffer[start], data, first);
+  memcpy(&rb->buffer[0], data + first, len - first);
+
+  STORE_RELEASE(rb->head, head + len);
+  return true;
+}
+
+uint32_t ringBufferPeek(const RingBuffer *rb, uint8_t *data, uint32_t len) {
+  uint32_t tail = rb->tail;
+  uint32_t used = LOAD_ACQUIRE(rb->head) - tail;
+  uint32_t size = rb->mask + 1;
+
+  if (len > used)
+    len = used;
+
+  uint32_t start = tail & rb->mask;
+  uint32_t first = size - start;
+  if (first > len)
+    first = len;
+  memcpy(data, &rb->buffer[start], first);
+  memcpy(data + first, &rb->buffer[0], len - first);
+
+  return len;
+}
+
+void ringBufferSkip(RingBuffer *rb, uint32_t len) {
+  STORE_RELEASE(rb->tail, rb->tail + len);
+}
+
+uint32_t ringBufferRead(RingBuffer *rb, uint8_t *data, uint32_t len) {
+  len = ringBufferPeek(rb, data, len);
+  ringBufferSkip(rb, len);
+  return len;
+}
@@ -0,0 +1,159 @@
+#include <string.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "config.h"
+#include "seriallink.h"
+#include "crtp_pool.h"
+#include "cfassert.h"
+
+#define SERIALLINK_RX_CHUNK 64
+
+void seriallinkInit(SerialLink *sl, osMessageQueueId_t delivery, osSemaphoreId_t txDone) {
+  syslinkParserInit(&sl->rxParser);
+  sl->delivery = delivery;
+  sl->txDone = txDone;
+}
+
+void seriallinkStampFromISR(SerialLink *sl, uint32_t stamp) {
+  uint32_t head = sl->rxStampHead;
+
+  /*! When full, the newest entry covers these bytes too, their stamp comes out late rather than early */
+  if (head - __atomic_load_n(&sl->rxStampTail, __ATOMIC_ACQUIRE) == SERIALLINK_RX_STAMPS) {
+    sl->rxStamps[(head - 1) % SERIALLINK_RX_STAMPS].end = sl->rxRing->head;
+    return;
+  }
+
+  sl->rxStamps[head % SERIALLINK_RX_STAMPS] = (SerialLinkStamp){ .end = sl->rxRing->head, .stamp = stamp };
+  __atomic_store_n(&sl->rxStampHead, head + 1, __ATOMIC_RELEASE);
+}
+
+/*! Arrival time of the byte that was just parsed */
+static uint32_t seriallinkParsedStamp(SerialLink *sl) {
+  uint32_t head = __atomic_load_n(&sl->rxStampHead, __ATOMIC_ACQUIRE);
+  uint32_t tail = sl->rxStampTail;
+
+  while (tail != head && (int32_t)(sl->rxStamps[tail % SERIALLINK_RX_STAMPS].end - sl->rxParsed) < 0)
+    __atomic_store_n(&sl->rxStampTail, ++tail, __ATOMIC_RELEASE);
+  if (tail != head)
+    sl->rxLastStamp = sl->rxStamps[tail % SERIALLINK_RX_STAMPS].stamp;
+
+  return sl->rxLastStamp;
+}
+
+static void seriallinkDeliver(SerialLink *sl, const SyslinkPacket *slp, uint32_t stamp) {
+  CRTPPacket *p;
+
+  if (slp->type != SYSLINK_RADIO_RAW || slp->length < 1 || slp->length > CRTP_MAX_DATA_SIZE + 1)
+    return;
+  sl->lastRxTick = osKernelGetTickCount();
+  sl->rxSeen = true;
+  if (crtpDispatchFast(slp->data, slp->length, stamp))
+    return;
+
+  /*! Wait for a packet rather than drop, the transport holds back once rxRing is full */
+  while ((p = crtpPoolAlloc()) == NULL)
+    osDelay(1);
+
+  p->size = slp->length - 1;
+  memcpy(p->raw, slp->data, slp->length);
+  crtpPoolSetTimestamp(p, stamp);
+  osMessageQueuePut(sl->delivery, &p, 0, osWaitForever);
+
+  uint32_t count = osMessageQueueGetCount(sl->delivery);
+  if (count > sl->rxHighWater)
+    sl->rxHighWater = count;
+}
+
+void seriallinkReceive(SerialLink *sl) {
+  uint8_t chunk[SERIALLINK_RX_CHUNK];
+  uint32_t len;
+
+  while ((len = ringBufferRead(sl->rxRing, chunk, sizeof(chunk))) > 0) {
+    if (sl->rxDrained)
+      sl->rxDrained();
+
+    for (uint32_t i = 0; i < len; i++) {
+      sl->rxParsed++;
+      if (syslinkParseByte(&sl->rxParser, chunk[i]))
+        seriallinkDeliver(sl, &sl->rxParser.packet, seriallinkParsedStamp(sl));
+    }
+  }
+}
+
+/*! Must be called with the transport interrupt masked */
+static void seriallinkTxStart(SerialLink *sl) {
+  if (sl->txBusy || sl->txFill == 0)
+    return;
+
+  if (sl->transmit(sl->txBuffer[sl->txFillIndex], sl->txFill)) {
+    sl->txBusy = true;
+    sl->txTransfers++;
+    sl->txFillIndex ^= 1;
+    sl->txFill = 0;
+  }
+}
+
+void seriallinkTxDoneFromISR(SerialLink *sl) {
+  UBaseType_t mask = taskENTER_CRITICAL_FROM_ISR();
+  sl->txBusy = false;
+  /*! Flush whatever was queued while the previous transfer was in flight */
+  seriallinkTxStart(sl);
+  taskEXIT_CRITICAL_FROM_ISR(mask);
+
+  if (sl->txDone)
+    osSemaphoreRelease(sl->txDone);
+}
+
+void seriallinkTxResetFromISR(SerialLink *sl) {
+  UBaseType_t mask = taskENTER_CRITICAL_FROM_ISR();
+  sl->txBusy = false;
+  taskEXIT_CRITICAL_FROM_ISR(mask);
+
+  if (sl->txDone)
+    osSemaphoreRelease(sl->txDone);
+}
+
+void seriallinkTxFlush(SerialLink *sl) {
+  taskENTER_CRITICAL();
+  seriallinkTxStart(sl);
+  taskEXIT_CRITICAL();
+}
+
+bool seriallinkSendPacket(SerialLink *sl, const CRTPPacket *p) {
+  int dataSize;
+
+  ASSERT(p->size <= CRTP_MAX_DATA_SIZE);
+
+  taskENTER_CRITICAL();
+  dataSize = syslinkEncode(&sl->txBuffer[sl->txFillIndex][sl->txFill], sl->txBufferSize - sl->txFill,
+                           SYSLINK_RADIO_RAW, p->raw, p->size + 1);
+  sl->txFill += dataSize;
+  if (dataSize > 0)
+    sl->txPackets++;
+  seriallinkTxStart(sl);
+  taskEXIT_CRITICAL();
+
+  return dataSize > 0;
+}
+
+bool seriallinkSendPacketWait(SerialLink *sl, const CRTPPacket *p, uint32_t timeout) {
+  uint32_t start = osKernelGetTickCount();
+  uint32_t elapsed;
+
+  while (!seriallinkSendPacket(sl, p)) {
+    elapsed = osKernelGetTickCount() - start;
+    if (elapsed >= timeout)
+      return false;
+    /*! A stale completion only costs one more attempt */
+    sl->txWaits++;
+    osSemaphoreAcquire(sl->txDone, timeout - elapsed);
+  }
+
+  return true;
+}
+
+bool seriallinkIsActive(const SerialLink *sl) {
+  return sl->rxSeen && osKernelGetTickCount() - sl->lastRxTick < CRTP_LINK_TIMEOUT_MS;
+}
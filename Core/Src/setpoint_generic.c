@@ -0,0 +1,127 @@
+#include <stddef.h>
+#include <string.h>
+
+#include "cmsis_os2.h"
+
+#include "config.h"
+#include "setpoint_generic.h"
+#include "controller.h"
+#include "crtp.h"
+#include "crtp_pool.h"
+
+#define Q15_TO_FLOAT(q) ((q) * (1.0f / 32768.0f))
+
+/**
+ * Layout of one type. The packet is 'size' bytes, or 'size' plus 1 to
+ * 'maxEntries' entries of 'entrySize' bytes when entrySize is not 0.
+ */
+typedef struct {
+  uint8_t size;
+  uint8_t entrySize;
+  uint8_t maxEntries;
+  void (*decode)(const uint8_t *data, int entries, uint32_t rxStamp);
+} SetpointGenericDecoder;
+
+static bool isInit = false;
+static uint32_t rejected;
+
+static void decodeStop(const uint8_t *data, int entries, uint32_t rxStamp);
+static void decodeRatio(const uint8_t *data, int entries, uint32_t rxStamp);
+static void decodeTimed(const uint8_t *data, int entries, uint32_t rxStamp);
+
+static const SetpointGenericDecoder decoders[SETPOINT_GENERIC_TYPE_COUNT] = {
+  [SETPOINT_GENERIC_STOP]      = { 1, 0, 0, decodeStop },
+  [SETPOINT_GENERIC_RATIO_Q15] = { sizeof(SetpointGenericRatio), 0, 0, decodeRatio },
+  [SETPOINT_GENERIC_TIMED_Q15] = { offsetof(SetpointGenericTimed, entries), sizeof(SetpointGenericTimedEntry),
+                                   SETPOINT_GENERIC_TIMED_MAX, decodeTimed },
+};
+
+static void decodeStop(const uint8_t *data, int entries, uint32_t rxStamp) {
+  controllerStop();
+}
+
+/*! Fields are copied out, the packet data is not aligned */
+static void decodeRatio(const uint8_t *data, int entries, uint32_t rxStamp) {
+  SetpointGenericRatio r;
+  setpoint_t sp;
+
+  memcpy(&r, data, sizeof(r));
+  sp.roll = Q15_TO_FLOAT(r.roll);
+  sp.pitch = Q15_TO_FLOAT(r.pitch);
+  sp.yaw = Q15_TO_FLOAT(r.yaw);
+  sp.thrust = r.thrust;
+  controllerSetpointPutRx(&sp, rxStamp);
+}
+
+static void decodeTimed(const uint8_t *data, int entries, uint32_t rxStamp) {
+  SetpointGenericTimed t;
+  setpoint_t sp[SETPOINT_GENERIC_TIMED_MAX];
+  uint32_t due[SETPOINT_GENERIC_TIMED_MAX];
+  uint32_t now = osKernelGetTickCount();
+
+  memcpy(&t, data, offsetof(SetpointGenericTimed, entries) + entries * sizeof(SetpointGenericTimedEntry));
+  for (int i = 0; i < entries; i++) {
+    if (i > 0 && t.entries[i].offset < t.entries[i - 1].offset) {
+      rejected++;
+      return;
+    }
+    sp[i].roll = Q15_TO_FLOAT(t.entries[i].roll);
+    sp[i].pitch = Q15_TO_FLOAT(t.entries[i].pitch);
+    sp[i].yaw = Q15_TO_FLOAT(t.entries[i].yaw);
+    sp[i].thrust = t.thrust;
+    due[i] = now + t.entries[i].offset * osKernelGetTickFreq() / 1000;
+  }
+  controllerSchedule(sp, due, entries);
+}
+
+/*! Checks the length against the table, then hands over to the decoder of the type */
+static void setpointGenericDispatch(const CRTPPacket *p, uint32_t rxStamp) {
+  const SetpointGenericDecoder *d;
+  int entries = 0;
+
+  if (p->size < 1 || p->data[0] >= SETPOINT_GENERIC_TYPE_COUNT) {
+    rejected++;
+    return;
+  }
+
+  d = &decoders[p->data[0]];
+  if (d->entrySize == 0) {
+    if (p->size != d->size) {
+      rejected++;
+      return;
+    }
+  } else {
+    entries = (p->size - d->size) / d->entrySize;
+    if (p->size < d->size || (p->size - d->size) % d->entrySize != 0 ||
+        entries < 1 || entries > d->maxEntries) {
+      rejected++;
+      return;
+    }
+  }
+
+  d->decode(p->data, entries, rxStamp);
+}
+
+static void setpointGenericPacket(CRTPPacket *p) {
+  setpointGenericDispatch(p, crtpPoolGetTimestamp(p));
+}
+
+void setpointGenericInit(void) {
+  if (isInit)
+    return;
+
+#if CONTROLLER_FAST_PATH
+  crtpRegisterFastPath(CRTP_PORT_SETPOINT_GENERIC, 0, setpointGenericDispatch);
+#endif
+  crtpSubscribe(CRTP_PORT_SETPOINT_GENERIC, 0, setpointGenericPacket);
+
+  isInit = true;
+}
+
+bool setpointGenericTest(void) {
+  return isInit;
+}
+
+uint32_t setpointGenericGetRejected(void) {
+  return rejected;
+}
@@ -0,0 +1,91 @@
+#include <string.h>
+
+#include "syslink.h"
+
+void syslinkParserInit(SyslinkParser *ps) {
+  memset(ps, 0, sizeof(*ps));
+  ps->state = waitForFirstStart;
+}
+
+bool syslinkParseByte(SyslinkParser *ps, uint8_t c) {
+  switch (ps->state) {
+    case waitForFirstStart:
+      if (c == SYSLINK_START_BYTE1)
+        ps->state = waitForSecondStart;
+      break;
+    case waitForSecondStart:
+      if (c == SYSLINK_START_BYTE2)
+        ps->state = waitForType;
+      else if (c != SYSLINK_START_BYTE1)
+        ps->state = waitForFirstStart;
+      break;
+    case waitForType:
+      ps->cksum[0] = c;
+      ps->cksum[1] = c;
+      ps->packet.type = c;
+      ps->state = waitForLength;
+      break;
+    case waitForLength:
+      if (c > SYSLINK_MTU) {
+        ps->errors++;
+        ps->state = waitForFirstStart;
+        break;
+      }
+      ps->packet.length = c;
+      ps->index = 0;
+      ps->cksum[0] += c;
+      ps->cksum[1] += ps->cksum[0];
+      ps->state = (c > 0) ? waitForData : waitForChksum1;
+      break;
+    case waitForData:
+      ps->packet.data[ps->index++] = c;
+      ps->cksum[0] += c;
+      ps->cksum[1] += ps->cksum[0];
+      if (ps->index == ps->packet.length)
+        ps->state = waitForChksum1;
+      break;
+    case waitForChksum1:
+      if (c == ps->cksum[0]) {
+        ps->state = waitForChksum2;
+      } else {
+        ps->errors++;
+        ps->state = (c == SYSLINK_START_BYTE1) ? waitForSecondStart : waitForFirstStart;
+      }
+      break;
+    case waitForChksum2:
+      ps->state = waitForFirstStart;
+      if (c == ps->cksum[1])
+        return true;
+      ps->errors++;
+      if (c == SYSLINK_START_BYTE1)
+        ps->state = waitForSecondStart;
+      break;
+    default:
+      ps->state = waitForFirstStart;
+      break;
+  }
+
+  return false;
+}
+
+int syslinkEncode(uint8_t *buf, int size, uint8_t type, const uint8_t *data, uint8_t length) {
+  uint8_t ck0 = 0, ck1 = 0;
+
+  if (length > SYSLINK_MTU || size < SYSLINK_FRAME_SIZE(length))
+    return 0;
+
+  buf[0] = SYSLINK_START_BYTE1;
+  buf[1] = SYSLINK_START_BYTE2;
+  buf[2] = type;
+  buf[3] = length;
+  memcpy(&buf[4], data, length);
+
+  for (int i = 2; i < 4 + length; i++) {
+    ck0 += buf[i];
+    ck1 += ck0;
+  }
+  buf[4 + length] = ck0;
+  buf[5 + length] = ck1;
+
+  return SYSLINK_FRAME_SIZE(length);
+}
@@ -35,6 +35,14 @@
 #include "static_mem.h"
 #include "controller.h"
 #include "usblink.h"
+#include "uartlink.h"
+#include "deferlog.h"
+#include "crtpservice.h"
+#include "cyclecounter.h"
+#include "latency.h"
+#include "setpoint_generic.h"
+#include "trajectory.h"
+#include "motorcal.h"
 #include <string.h>
 
 /* Private variable */
@@ -62,10 +70,21 @@ static void systemInit(void) {
 
   STATIC_SEMAPHORE_CREATE(canStartSemaphore, 1, 0);
   
+  cycleCounterInit();
+  latencyInit();
+  deferlogInit();
   crtpInit();
   usblinkInit();
   crtpSetLink(usblinkGetLink());
+#ifdef CRTP_LINK_UART
+  uartlinkInit();
+  crtpAddLink(uartlinkGetLink());
+#endif
+  crtpserviceInit();
   controllerInit();
+  setpointGenericInit();
+  trajectoryInit();
+  motorcalInit();
 
   DEBUG_PRINT_UART("----------------------------\n");
   DEBUG_PRINT_UART("System Init.\n");
@@ -88,7 +107,7 @@ void systemTask(void *arg) {
     selftestPassed = 1;
     systemStart(); 
   }
-  DEBUG_PRINT_UART("Free heap: %d bytes\n", xPortGetFreeHeapSize());
+  DEBUG_PRINT_UART("Free heap: %u bytes\n", (unsigned)xPortGetFreeHeapSize());
 
   while (1)
     osDelay(osWaitForever);
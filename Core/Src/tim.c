@@ -94,6 +94,13 @@ void MX_TIM1_Init(void)
     Error_Handler();
   }
   /* USER CODE BEGIN TIM1_Init 2 */
+  /* TIM1 starts TIM2, so the PWM periods of all motors begin together */
+  sMasterConfig.MasterOutputTrigger = TIM_TRGO_ENABLE;
+  sMasterConfig.MasterSlaveMode = TIM_MASTERSLAVEMODE_DISABLE;
+  if (HAL_TIMEx_MasterConfigSynchronization(&htim1, &sMasterConfig) != HAL_OK)
+  {
+    Error_Handler();
+  }
 
   /* USER CODE END TIM1_Init 2 */
   HAL_TIM_MspPostInit(&htim1);
@@ -150,6 +157,14 @@ void MX_TIM2_Init(void)
     Error_Handler();
   }
   /* USER CODE BEGIN TIM2_Init 2 */
+  /* Counter enabled by the TRGO of TIM1 (ITR0) rather than by HAL_TIM_PWM_Start */
+  TIM_SlaveConfigTypeDef sSlaveConfig = {0};
+  sSlaveConfig.SlaveMode = TIM_SLAVEMODE_TRIGGER;
+  sSlaveConfig.InputTrigger = TIM_TS_ITR0;
+  if (HAL_TIM_SlaveConfigSynchro(&htim2, &sSlaveConfig) != HAL_OK)
+  {
+    Error_Handler();
+  }
 
   /* USER CODE END TIM2_Init 2 */
   HAL_TIM_MspPostInit(&htim2);
@@ -265,6 +280,26 @@ void HAL_TIM_PWM_MspDeInit(TIM_HandleTypeDef* tim_pwmHandle)
 
 /* USER CODE BEGIN 1 */
 
+/**
+  * @brief  Counter clock of a timer, before its prescaler. Timers on a divided
+  *         APB bus run at twice the bus clock.
+  * @param  htim TIM handle
+  * @retval Clock in Hz
+  */
+uint32_t timGetClockFreq(TIM_HandleTypeDef *htim)
+{
+  uint32_t pclk;
+
+  if (htim->Instance == TIM1 || htim->Instance == TIM8 || htim->Instance == TIM9 ||
+      htim->Instance == TIM10 || htim->Instance == TIM11)
+  {
+    pclk = HAL_RCC_GetPCLK2Freq();
+    return (RCC->CFGR & RCC_CFGR_PPRE2) == RCC_CFGR_PPRE2_DIV1 ? pclk : 2 * pclk;
+  }
+  pclk = HAL_RCC_GetPCLK1Freq();
+  return (RCC->CFGR & RCC_CFGR_PPRE1) == RCC_CFGR_PPRE1_DIV1 ? pclk : 2 * pclk;
+}
+
 /* USER CODE END 1 */
 
 /************************ (C) COPYRIGHT STMicroelectronics *****END OF FILE****/
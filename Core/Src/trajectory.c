@@ -0,0 +1,286 @@
+#include <string.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "cmsis_os2.h"
+
+#include "trajectory.h"
+#include "crtp.h"
+#include "controller.h"
+
+#define Q15_TO_FLOAT(q) ((q) * (1.0f / 32768.0f))
+/*! Slot used by go-to, after the uploadable ones */
+#define TRAJECTORY_GOTO_SLOT TRAJECTORY_SEGMENTS
+
+typedef struct {
+  bool valid;
+  uint32_t duration;      //< Ticks
+  uint16_t thrust;
+  float coeff[3][4];      //< roll, pitch, yaw
+} TrajectorySegment;
+
+static bool isInit = false;
+
+static TrajectorySegment segments[TRAJECTORY_SEGMENTS + 1];
+static uint8_t queue[TRAJECTORY_QUEUE_SIZE];
+static uint32_t queueHead;      //< Free running, like the ring buffer indexes
+static uint32_t queueTail;
+static bool running;
+static bool started;            //< The running segment has a start tick
+static bool holding;            //< The queue ran out, the last segment is held
+static int current;
+static uint32_t segmentStart;
+
+static uint32_t trajectoryMsToTicks(uint16_t ms) {
+  return (uint32_t)ms * osKernelGetTickFreq() / 1000;
+}
+
+static float trajectoryEval(const float *c, float s) {
+  return c[0] + s * (c[1] + s * (c[2] + s * c[3]));
+}
+
+/*! Must be called in a critical section */
+static bool trajectoryNext(void) {
+  if (queueTail == queueHead)
+    return false;
+  current = queue[queueTail++ % TRAJECTORY_QUEUE_SIZE];
+  return true;
+}
+
+bool trajectoryUpdate(uint32_t tick, setpoint_t *sp) {
+  TrajectorySegment seg;
+  uint32_t elapsed;
+
+  /*! Holding a value forever is only safe while someone can still stop it. A quiet host still can */
+  if (running && !crtpIsConnected())
+    trajectoryStop();
+
+  UBaseType_t mask = taskENTER_CRITICAL_FROM_ISR();
+  if (!running) {
+    taskEXIT_CRITICAL_FROM_ISR(mask);
+    return false;
+  }
+  if (!started) {
+    segmentStart = tick;
+    started = true;
+    holding = false;
+  }
+  /*! Segments are chained on their nominal end, so a late period does not stretch the plan */
+  while (tick - segmentStart >= segments[current].duration) {
+    uint32_t end = segmentStart + segments[current].duration;
+    int last = current;
+
+    if (!trajectoryNext()) {
+      current = last;
+      holding = true;
+      break;
+    }
+    /*! A segment appended while holding starts now */
+    segmentStart = holding ? tick : end;
+    holding = false;
+  }
+  seg = segments[current];
+  elapsed = tick - segmentStart;
+  taskEXIT_CRITICAL_FROM_ISR(mask);
+
+  float s = seg.duration == 0 || elapsed >= seg.duration ? 1.0f : (float)elapsed / seg.duration;
+  sp->roll = trajectoryEval(seg.coeff[0], s);
+  sp->pitch = trajectoryEval(seg.coeff[1], s);
+  sp->yaw = trajectoryEval(seg.coeff[2], s);
+  sp->thrust = seg.thrust;
+
+  return true;
+}
+
+void trajectoryStop(void) {
+  UBaseType_t mask = taskENTER_CRITICAL_FROM_ISR();
+  running = false;
+  queueTail = queueHead;
+  taskEXIT_CRITICAL_FROM_ISR(mask);
+}
+
+static TrajectoryStatus trajectoryUploadPoly(const CRTPPacket *p) {
+  TrajectoryPolyUpload up;
+  TrajectorySegment seg = { .valid = true };
+
+  if (p->size != sizeof(up))
+    return TRAJECTORY_ERROR_LENGTH;
+  memcpy(&up, p->data, sizeof(up));
+  if (up.index >= TRAJECTORY_SEGMENTS)
+    return TRAJECTORY_ERROR_INDEX;
+
+  seg.duration = trajectoryMsToTicks(up.duration);
+  seg.thrust = up.thrust;
+  for (int axis = 0; axis < 3; axis++) {
+    for (int i = 0; i < 4; i++)
+      seg.coeff[axis][i] = up.coeff[axis][i] / TRAJECTORY_COEFF_SCALE;
+  }
+
+  taskENTER_CRITICAL();
+  segments[up.index] = seg;
+  taskEXIT_CRITICAL();
+  return TRAJECTORY_OK;
+}
+
+static TrajectoryStatus trajectoryUploadHold(const CRTPPacket *p) {
+  TrajectoryHoldUpload up;
+  TrajectorySegment seg = { .valid = true };
+
+  if (p->size != sizeof(up))
+    return TRAJECTORY_ERROR_LENGTH;
+  memcpy(&up, p->data, sizeof(up));
+  if (up.index >= TRAJECTORY_SEGMENTS)
+    return TRAJECTORY_ERROR_INDEX;
+
+  seg.duration = trajectoryMsToTicks(up.duration);
+  seg.thrust = up.thrust;
+  seg.coeff[0][0] = Q15_TO_FLOAT(up.roll);
+  seg.coeff[1][0] = Q15_TO_FLOAT(up.pitch);
+  seg.coeff[2][0] = Q15_TO_FLOAT(up.yaw);
+
+  taskENTER_CRITICAL();
+  segments[up.index] = seg;
+  taskEXIT_CRITICAL();
+  return TRAJECTORY_OK;
+}
+
+static TrajectoryStatus trajectoryStart(const CRTPPacket *p) {
+  TrajectoryStatus status = TRAJECTORY_OK;
+  uint8_t first, count;
+
+  if (p->size != 3)
+    return TRAJECTORY_ERROR_LENGTH;
+  first = p->data[1];
+  count = p->data[2];
+  if (count > TRAJECTORY_QUEUE_SIZE || first + count > TRAJECTORY_SEGMENTS)
+    return TRAJECTORY_ERROR_INDEX;
+  for (int i = first; i < first + count; i++) {
+    if (!segments[i].valid)
+      return TRAJECTORY_ERROR_INDEX;
+  }
+
+  taskENTER_CRITICAL();
+  if (count > 0) {
+    queueTail = queueHead = 0;
+    for (int i = 0; i < count; i++)
+      queue[queueHead++] = first + i;
+  }
+  if (trajectoryNext()) {
+    running = true;
+    started = false;
+  } else {
+    status = TRAJECTORY_ERROR_EMPTY;
+  }
+  taskEXIT_CRITICAL();
+
+  return status;
+}
+
+static TrajectoryStatus trajectoryAppend(const CRTPPacket *p) {
+  TrajectoryStatus status = TRAJECTORY_OK;
+  uint8_t index;
+
+  if (p->size != 2)
+    return TRAJECTORY_ERROR_LENGTH;
+  index = p->data[1];
+  if (index >= TRAJECTORY_SEGMENTS || !segments[index].valid)
+    return TRAJECTORY_ERROR_INDEX;
+
+  taskENTER_CRITICAL();
+  if (queueHead - queueTail < TRAJECTORY_QUEUE_SIZE)
+    queue[queueHead++ % TRAJECTORY_QUEUE_SIZE] = index;
+  else
+    status = TRAJECTORY_ERROR_FULL;
+  taskEXIT_CRITICAL();
+
+  return status;
+}
+
+/*! Smooth step a + (b - a)(3s^2 - 2s^3), zero rate at both ends */
+static void trajectorySmoothStep(float *c, float from, float to) {
+  c[0] = from;
+  c[1] = 0.0f;
+  c[2] = 3.0f * (to - from);
+  c[3] = -2.0f * (to - from);
+}
+
+static TrajectoryStatus trajectoryGoto(const CRTPPacket *p) {
+  TrajectoryGoto go;
+  TrajectorySegment seg = { .valid = true };
+  setpoint_t from;
+
+  if (p->size != sizeof(go))
+    return TRAJECTORY_ERROR_LENGTH;
+  memcpy(&go, p->data, sizeof(go));
+
+  /*! Whatever drives the motors now, plan or low level setpoints, zeros when stopped */
+  controllerGetOutput(&from);
+
+  seg.duration = trajectoryMsToTicks(go.duration);
+  seg.thrust = go.thrust;
+  trajectorySmoothStep(seg.coeff[0], from.roll, Q15_TO_FLOAT(go.roll));
+  trajectorySmoothStep(seg.coeff[1], from.pitch, Q15_TO_FLOAT(go.pitch));
+  trajectorySmoothStep(seg.coeff[2], from.yaw, Q15_TO_FLOAT(go.yaw));
+
+  taskENTER_CRITICAL();
+  segments[TRAJECTORY_GOTO_SLOT] = seg;
+  queueTail = queueHead;
+  current = TRAJECTORY_GOTO_SLOT;
+  running = true;
+  started = false;
+  taskEXIT_CRITICAL();
+
+  return TRAJECTORY_OK;
+}
+
+/*! Runs in crtpRxTask, the reply is dropped rather than waited for */
+static void trajectoryPacket(CRTPPacket *p) {
+  TrajectoryStatus status;
+  CRTPPacket reply;
+
+  if (p->channel != 0 || p->size < 1)
+    return;
+
+  switch (p->data[0]) {
+    case TRAJECTORY_CMD_POLY:
+      status = trajectoryUploadPoly(p);
+      break;
+    case TRAJECTORY_CMD_HOLD:
+      status = trajectoryUploadHold(p);
+      break;
+    case TRAJECTORY_CMD_START:
+      status = trajectoryStart(p);
+      break;
+    case TRAJECTORY_CMD_APPEND:
+      status = trajectoryAppend(p);
+      break;
+    case TRAJECTORY_CMD_STOP:
+      controllerStop();
+      status = TRAJECTORY_OK;
+      break;
+    case TRAJECTORY_CMD_GOTO:
+      status = trajectoryGoto(p);
+      break;
+    default:
+      status = TRAJECTORY_ERROR_COMMAND;
+      break;
+  }
+
+  reply = *p;
+  reply.data[1] = status;
+  reply.size = 2;
+  crtpSendPacket(&reply);
+}
+
+void trajectoryInit(void) {
+  if (isInit)
+    return;
+
+  crtpSubscribe(CRTP_PORT_SETPOINT_HL, 0, trajectoryPacket);
+
+  isInit = true;
+}
+
+bool trajectoryTest(void) {
+  return isInit;
+}
@@ -0,0 +1,260 @@
+#include <stdbool.h>
+#include <string.h>
+
+#include "config.h"
+#include "uartlink.h"
+#include "crtp.h"
+#include "ringbuf.h"
+#include "seriallink.h"
+#include "static_mem.h"
+#include "task.h"
+#include "cfassert.h"
+#include "cyclecounter.h"
+
+#include "usart.h"
+
+#define UARTLINK_DMA_RX_SIZE 256
+#define UARTLINK_RX_BUFFER_SIZE 1024
+#define UARTLINK_TX_BUFFER_SIZE 256
+#define UARTLINK_RX_FLAG 0x01
+#define UARTLINK_IRQ_PRI 5      // Calls into the kernel, must not be above configMAX_SYSCALL_INTERRUPT_PRIORITY
+
+DMA_HandleTypeDef hdma_usart2_rx;
+DMA_HandleTypeDef hdma_usart2_tx;
+
+static bool isInit = false;
+STATIC_MEM_QUEUE_ALLOC(uartPacketDelivery, 16, sizeof(CRTPPacket *));
+
+/*! Written by the DMA, never stopped; rxDmaPos is how far the interrupt has copied it out */
+static uint8_t rxDmaBuffer[UARTLINK_DMA_RX_SIZE];
+static uint16_t rxDmaPos;
+
+/*! Filled by the UART interrupt, drained by uartlinkTask */
+RINGBUF_ALLOC(rxRing, UARTLINK_RX_BUFFER_SIZE);
+static osThreadId_t uartlinkTaskId;
+static volatile uint32_t rxDropped;
+static volatile uint32_t rxLineErrors;
+
+/*! One half is on the DMA while packets are appended to the other */
+static uint8_t txBuffer[2][UARTLINK_TX_BUFFER_SIZE];
+STATIC_MEM_SEMAPHORE_ALLOC(uartTxDone);
+
+static bool uartlinkTransmit(uint8_t *data, uint32_t len);
+
+static SerialLink serial = {
+  .rxRing = &rxRing,
+  .transmit = uartlinkTransmit,
+  .txBuffer = { txBuffer[0], txBuffer[1] },
+  .txBufferSize = UARTLINK_TX_BUFFER_SIZE,
+};
+
+static int uartlinkSendPacket(CRTPPacket *p);
+static int uartlinkSendPacketWait(CRTPPacket *p, uint32_t timeout);
+static int uartlinkSetEnable(bool enable);
+static int uartlinkReceivePacket(CRTPPacket **p);
+static bool uartlinkIsConnected(void);
+static bool uartlinkIsActive(void);
+
+STATIC_MEM_TASK_ALLOC(uartlinkTask, UARTLINK_TASK_STACKSIZE);
+
+static struct crtpLinkOperations uartlinkOp = {
+  .setEnable         = uartlinkSetEnable,
+  .sendPacket        = uartlinkSendPacket,
+  .sendPacketWait    = uartlinkSendPacketWait,
+  .receivePacket     = uartlinkReceivePacket,
+  .isConnected       = uartlinkIsConnected,
+  .isActive          = uartlinkIsActive,
+};
+
+#ifdef UARTLINK_DTR_PIN
+/*! Pulled up, so a modem that is not plugged in reads as no host */
+static void uartlinkDtrInit(void) {
+  GPIO_InitTypeDef GPIO_InitStruct = {0};
+
+  GPIO_InitStruct.Pin = UARTLINK_DTR_PIN;
+  GPIO_InitStruct.Mode = GPIO_MODE_INPUT;
+  GPIO_InitStruct.Pull = GPIO_PULLUP;
+  HAL_GPIO_Init(UARTLINK_DTR_PORT, &GPIO_InitStruct);
+}
+#endif
+
+static void uartlinkDmaInit(void) {
+  __HAL_RCC_DMA1_CLK_ENABLE();
+
+  hdma_usart2_rx.Instance = DMA1_Stream5;
+  hdma_usart2_rx.Init.Channel = DMA_CHANNEL_4;
+  hdma_usart2_rx.Init.Direction = DMA_PERIPH_TO_MEMORY;
+  hdma_usart2_rx.Init.PeriphInc = DMA_PINC_DISABLE;
+  hdma_usart2_rx.Init.MemInc = DMA_MINC_ENABLE;
+  hdma_usart2_rx.Init.PeriphDataAlignment = DMA_PDATAALIGN_BYTE;
+  hdma_usart2_rx.Init.MemDataAlignment = DMA_MDATAALIGN_BYTE;
+  hdma_usart2_rx.Init.Mode = DMA_CIRCULAR;
+  hdma_usart2_rx.Init.Priority = DMA_PRIORITY_HIGH;
+  hdma_usart2_rx.Init.FIFOMode = DMA_FIFOMODE_DISABLE;
+  if (HAL_DMA_Init(&hdma_usart2_rx) != HAL_OK)
+    Error_Handler();
+  __HAL_LINKDMA(&uartlinkUart, hdmarx, hdma_usart2_rx);
+
+  hdma_usart2_tx.Instance = DMA1_Stream6;
+  hdma_usart2_tx.Init.Channel = DMA_CHANNEL_4;
+  hdma_usart2_tx.Init.Direction = DMA_MEMORY_TO_PERIPH;
+  hdma_usart2_tx.Init.PeriphInc = DMA_PINC_DISABLE;
+  hdma_usart2_tx.Init.MemInc = DMA_MINC_ENABLE;
+  hdma_usart2_tx.Init.PeriphDataAlignment = DMA_PDATAALIGN_BYTE;
+  hdma_usart2_tx.Init.MemDataAlignment = DMA_MDATAALIGN_BYTE;
+  hdma_usart2_tx.Init.Mode = DMA_NORMAL;
+  hdma_usart2_tx.Init.Priority = DMA_PRIORITY_MEDIUM;
+  hdma_usart2_tx.Init.FIFOMode = DMA_FIFOMODE_DISABLE;
+  if (HAL_DMA_Init(&hdma_usart2_tx) != HAL_OK)
+    Error_Handler();
+  __HAL_LINKDMA(&uartlinkUart, hdmatx, hdma_usart2_tx);
+
+  HAL_NVIC_SetPriority(DMA1_Stream5_IRQn, UARTLINK_IRQ_PRI, 0);
+  HAL_NVIC_EnableIRQ(DMA1_Stream5_IRQn);
+  HAL_NVIC_SetPriority(DMA1_Stream6_IRQn, UARTLINK_IRQ_PRI, 0);
+  HAL_NVIC_EnableIRQ(DMA1_Stream6_IRQn);
+  HAL_NVIC_SetPriority(USART2_IRQn, UARTLINK_IRQ_PRI, 0);
+  HAL_NVIC_EnableIRQ(USART2_IRQn);
+}
+
+/*! Reception stays armed for good, only a line error stops it */
+static void uartlinkStartReceive(void) {
+  rxDmaPos = 0;
+  if (HAL_UARTEx_ReceiveToIdle_DMA(&uartlinkUart, rxDmaBuffer, sizeof(rxDmaBuffer)) != HAL_OK)
+    Error_Handler();
+}
+
+static void uartlinkCopyFromISR(const uint8_t *data, uint32_t len) {
+  if (!ringBufferWrite(&rxRing, data, len))
+    rxDropped += len;
+}
+
+/*! Idle line, half and full buffer events, 'pos' is where the DMA is in rxDmaBuffer */
+void HAL_UARTEx_RxEventCallback(UART_HandleTypeDef *huart, uint16_t pos) {
+  uint32_t stamp = cycleCounterGet();
+  uint32_t ringHead = rxRing.head;
+  bool wasEmpty;
+
+  if (huart != &uartlinkUart || pos == rxDmaPos)
+    return;
+
+  wasEmpty = ringBufferUsed(&rxRing) == 0;
+  if (pos > rxDmaPos) {
+    uartlinkCopyFromISR(&rxDmaBuffer[rxDmaPos], pos - rxDmaPos);
+  } else {
+    uartlinkCopyFromISR(&rxDmaBuffer[rxDmaPos], sizeof(rxDmaBuffer) - rxDmaPos);
+    uartlinkCopyFromISR(rxDmaBuffer, pos);
+  }
+  rxDmaPos = pos == sizeof(rxDmaBuffer) ? 0 : pos;
+  if (rxRing.head != ringHead)
+    seriallinkStampFromISR(&serial, stamp);
+
+  /*! The task drains the whole ring once woken, as in usblink */
+  if (wasEmpty && uartlinkTaskId)
+    osThreadFlagsSet(uartlinkTaskId, UARTLINK_RX_FLAG);
+}
+
+void HAL_UART_ErrorCallback(UART_HandleTypeDef *huart) {
+  if (huart != &uartlinkUart)
+    return;
+
+  /*! The HAL aborts a DMA reception on overrun, the parser resynchronises on the next frame */
+  rxLineErrors++;
+  uartlinkStartReceive();
+}
+
+static void uartlinkTask(void *param) {
+  while (1) {
+    osThreadFlagsWait(UARTLINK_RX_FLAG, osFlagsWaitAny, osWaitForever);
+    seriallinkReceive(&serial);
+  }
+}
+
+void uartlinkGetStats(UartlinkStats *stats) {
+  taskENTER_CRITICAL();
+  stats->rxDropped = rxDropped;
+  stats->rxErrors = serial.rxParser.errors;
+  stats->rxLineErrors = rxLineErrors;
+  stats->txPackets = serial.txPackets;
+  stats->txTransfers = serial.txTransfers;
+  stats->txWaits = serial.txWaits;
+  stats->rxHighWater = serial.rxHighWater;
+  taskEXIT_CRITICAL();
+}
+
+static int uartlinkReceivePacket(CRTPPacket **p) {
+  if (osMessageQueueGet(uartPacketDelivery, p, NULL, 100) == osOK)
+    return 0;
+  return -1;
+}
+
+static bool uartlinkTransmit(uint8_t *data, uint32_t len) {
+  return HAL_UART_Transmit_DMA(&uartlinkUart, data, len) == HAL_OK;
+}
+
+void HAL_UART_TxCpltCallback(UART_HandleTypeDef *huart) {
+  if (huart != &uartlinkUart)
+    return;
+
+  seriallinkTxDoneFromISR(&serial);
+}
+
+static int uartlinkSendPacket(CRTPPacket *p) {
+  return seriallinkSendPacket(&serial, p);
+}
+
+static int uartlinkSendPacketWait(CRTPPacket *p, uint32_t timeout) {
+  return seriallinkSendPacketWait(&serial, p, timeout);
+}
+
+/*! DTR is driven low by the modem while its host has the port open */
+static bool uartlinkIsConnected(void) {
+#ifdef UARTLINK_DTR_PIN
+  return HAL_GPIO_ReadPin(UARTLINK_DTR_PORT, UARTLINK_DTR_PIN) == GPIO_PIN_RESET;
+#else
+  return true;
+#endif
+}
+
+/*! A radio modem keeps the UART up when out of range, only traffic tells that */
+static bool uartlinkIsActive(void) {
+  return seriallinkIsActive(&serial);
+}
+
+static int uartlinkSetEnable(bool enable) {
+  return 0;
+}
+
+/*
+ * Public functions
+ */
+
+void uartlinkInit() {
+  if (isInit)
+    return;
+
+  STATIC_SEMAPHORE_CREATE(uartTxDone, 1, 0);
+  STATIC_MEM_QUEUE_CREATE(uartPacketDelivery);
+  seriallinkInit(&serial, uartPacketDelivery, uartTxDone);
+  uartlinkTaskId = STATIC_MEM_TASK_CREATE(uartlinkTask, uartlinkTask, UARTLINK_TASK_NAME, NULL, UARTLINK_TASK_PRI);
+
+  /*! Re-run the CubeMX setup at the link rate, the DMA handles are linked before reception starts */
+  uartlinkUart.Init.BaudRate = UARTLINK_BAUDRATE;
+  if (HAL_UART_Init(&uartlinkUart) != HAL_OK)
+    Error_Handler();
+  uartlinkDmaInit();
+#ifdef UARTLINK_DTR_PIN
+  uartlinkDtrInit();
+#endif
+  uartlinkStartReceive();
+
+  isInit = true;
+}
+
+bool uartlinkTest() {
+  return isInit;
+}
+
+struct crtpLinkOperations * uartlinkGetLink() {
+  return &uartlinkOp;
+}
@@ -4,26 +4,60 @@
 #include "config.h"
 #include "usblink.h"
 #include "crtp.h"
+#include "ringbuf.h"
+#include "seriallink.h"
 #include "static_mem.h"
+#include "task.h"
 #include "cfassert.h"
 #include "debug.h"
+#include "cyclecounter.h"
 
 #include "usbd_cdc_if.h"
 
+#define USBLINK_RX_BUFFER_SIZE 512
+#define USBLINK_RX_FLAG 0x01
+#define USBLINK_TX_FLAG 0x02
+#define USBLINK_TX_BUFFER_SIZE (APP_TX_DATA_SIZE / 2)
+
 static bool isInit = false;
-STATIC_MEM_QUEUE_ALLOC(crtpPacketDelivery, 16, sizeof(CRTPPacket));
-static uint8_t sendBuffer[64];
+STATIC_MEM_QUEUE_ALLOC(crtpPacketDelivery, 16, sizeof(CRTPPacket *));
+/*! Released by every IN transfer completion */
+STATIC_MEM_SEMAPHORE_ALLOC(txDone);
+
+/*! Filled by the USB interrupt, drained by usblinkTask */
+RINGBUF_ALLOC(rxRing, USBLINK_RX_BUFFER_SIZE);
+static osThreadId_t usblinkTaskId;
+static volatile bool rxPaused;
+static volatile uint32_t rxDropped;
+
+static bool usblinkTransmit(uint8_t *data, uint32_t len);
+static void usblinkRxDrained(void);
+
+/*! UserTxBufferFS split in two halves: one is being sent while packets are appended to the other */
+static SerialLink serial = {
+  .rxRing = &rxRing,
+  .transmit = usblinkTransmit,
+  .rxDrained = usblinkRxDrained,
+  .txBuffer = { &UserTxBufferFS[0], &UserTxBufferFS[USBLINK_TX_BUFFER_SIZE] },
+  .txBufferSize = USBLINK_TX_BUFFER_SIZE,
+};
 
 static int usblinkSendPacket(CRTPPacket *p);
+static int usblinkSendPacketWait(CRTPPacket *p, uint32_t timeout);
 static int usblinkSetEnable(bool enable);
-static int usblinkReceivePacket(CRTPPacket *p);
+static int usblinkReceivePacket(CRTPPacket **p);
+static bool usblinkIsConnected(void);
+static bool usblinkIsActive(void);
 
-// STATIC_MEM_TASK_ALLOC(usblinkTask, USBLINK_TASK_STACKSIZE);
+STATIC_MEM_TASK_ALLOC(usblinkTask, USBLINK_TASK_STACKSIZE);
 
 static struct crtpLinkOperations usblinkOp = {
   .setEnable         = usblinkSetEnable,
   .sendPacket        = usblinkSendPacket,
+  .sendPacketWait    = usblinkSendPacketWait,
   .receivePacket     = usblinkReceivePacket,
+  .isConnected       = usblinkIsConnected,
+  .isActive          = usblinkIsActive,
 };
 
 /* Radio task handles the CRTP packet transfers as well as the radio link
@@ -31,43 +65,94 @@ static struct crtpLinkOperations usblinkOp = {
  * and so much other cool things that I don't have time for it ...)
  */
 
-// static CRTPPacket p;
-// static void usblinkTask(void *param) {
-//   while (1) {
-//     // Fetch a USB packet off the queue
-//     usbGetDataBlocking(&usbIn);
-//     p.size = usbIn.size - 1;
-//     memcpy(&p.raw, usbIn.data, usbIn.size);
-//     // This queuing will copy a CRTP packet size from usbIn
-//     osMessageQueuePut(crtpPacketDelivery, &p, 0, osWaitForever);
-//   }
-// }
+bool usblinkReceiveFromISR(const uint8_t *data, uint32_t len) {
+  bool wasEmpty = ringBufferUsed(&rxRing) == 0;
+  uint32_t stamp = cycleCounterGet();
+
+  if (ringBufferWrite(&rxRing, data, len)) {
+    seriallinkStampFromISR(&serial, stamp);
+    /*! The task drains the whole ring once woken, so only the first transfer of a burst notifies */
+    if (wasEmpty && usblinkTaskId)
+      osThreadFlagsSet(usblinkTaskId, USBLINK_RX_FLAG);
+  } else {
+    rxDropped++;
+  }
 
-void usblinkMessagePut(CRTPPacket *p) {
-  DEBUG_PRINT_UART("lk: %s\n", (char *)p);
-  osMessageQueuePut(crtpPacketDelivery, p, 0, 0);
+  /*! Leave the endpoint NAKing until the task has made room for a full transfer */
+  if (ringBufferFree(&rxRing) < CDC_DATA_FS_MAX_PACKET_SIZE) {
+    rxPaused = true;
+    return false;
+  }
+  return true;
+}
+
+static void usblinkRxDrained(void) {
+  if (rxPaused && ringBufferFree(&rxRing) >= CDC_DATA_FS_MAX_PACKET_SIZE) {
+    rxPaused = false;
+    CDC_ResumeReceive_FS();
+  }
 }
 
-static int usblinkReceivePacket(CRTPPacket *p) {
+static void usblinkTask(void *param) {
+  uint32_t flags;
+
+  while (1) {
+    flags = osThreadFlagsWait(USBLINK_RX_FLAG | USBLINK_TX_FLAG, osFlagsWaitAny, osWaitForever);
+
+    /*! The class is up by now, restart what was queued before the reset */
+    if (flags & USBLINK_TX_FLAG)
+      seriallinkTxFlush(&serial);
+    seriallinkReceive(&serial);
+  }
+}
+
+void usblinkGetStats(UsblinkStats *stats) {
+  taskENTER_CRITICAL();
+  stats->rxDropped = rxDropped;
+  stats->rxErrors = serial.rxParser.errors;
+  stats->txPackets = serial.txPackets;
+  stats->txTransfers = serial.txTransfers;
+  stats->txWaits = serial.txWaits;
+  stats->rxHighWater = serial.rxHighWater;
+  taskEXIT_CRITICAL();
+}
+
+static int usblinkReceivePacket(CRTPPacket **p) {
   //TODO: check the delay here
   if (osMessageQueueGet(crtpPacketDelivery, p, NULL, 100) == osOK)
     return 0;
   return -1;
 }
 
-static int usblinkSendPacket(CRTPPacket *p) {
-  int dataSize;
+static bool usblinkTransmit(uint8_t *data, uint32_t len) {
+  return CDC_Transmit_FS(data, len) == USBD_OK;
+}
 
-  ASSERT(p->size < 32);
+void usblinkTxDoneFromISR(void) {
+  seriallinkTxDoneFromISR(&serial);
+}
 
-  sendBuffer[0] = p->header;
+void usblinkTxResetFromISR(void) {
+  seriallinkTxResetFromISR(&serial);
+  if (usblinkTaskId)
+    osThreadFlagsSet(usblinkTaskId, USBLINK_TX_FLAG);
+}
 
-  if (p->size <= CRTP_MAX_DATA_SIZE) {
-    memcpy(&sendBuffer[1], p->data, p->size);
-  }
-  dataSize = p->size + 1;
+static int usblinkSendPacket(CRTPPacket *p) {
+  return seriallinkSendPacket(&serial, p);
+}
+
+static int usblinkSendPacketWait(CRTPPacket *p, uint32_t timeout) {
+  return seriallinkSendPacketWait(&serial, p, timeout);
+}
+
+/*! Up from enumeration to unplug, whether or not the host sends anything */
+static bool usblinkIsConnected(void) {
+  return CDC_IsConfigured_FS();
+}
 
-  return CDC_Transmit_FS(sendBuffer, dataSize);
+static bool usblinkIsActive(void) {
+  return seriallinkIsActive(&serial);
 }
 
 // TODO: implement this
@@ -83,8 +168,10 @@ void usblinkInit() {
   if (isInit)
     return;
 
+  STATIC_SEMAPHORE_CREATE(txDone, 1, 0);
   STATIC_MEM_QUEUE_CREATE(crtpPacketDelivery);
-  // STATIC_MEM_TASK_CREATE(usblinkTask, usblinkTask, USBLINK_TASK_NAME, NULL, USBLINK_TASK_PRI);
+  seriallinkInit(&serial, crtpPacketDelivery, txDone);
+  usblinkTaskId = STATIC_MEM_TASK_CREATE(usblinkTask, usblinkTask, USBLINK_TASK_NAME, NULL, USBLINK_TASK_PRI);
 
   isInit = true;
 }
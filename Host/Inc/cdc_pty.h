@@ -0,0 +1,23 @@
+#ifndef __CDC_PTY_H__
+#define __CDC_PTY_H__
+
+#include <stdbool.h>
+
+#define CDC_PTY_TASK_NAME       "CDC-PTY"
+#define CDC_PTY_TASK_PRI        4
+#define CDC_PTY_TASK_STACKSIZE  configMINIMAL_STACK_SIZE
+
+/**
+ * Emulate the USB CDC endpoint with a pseudo terminal.
+ *
+ * The bytes written to the slave side reach usblinkReceiveFromISR() in chunks
+ * of at most one full speed packet, and CDC_Transmit_FS() transfers complete
+ * with usblinkTxDoneFromISR() once they have been written to the master side,
+ * so usblink runs unmodified. Must be called after osKernelInitialize().
+ *
+ * @param[in] linkPath If not NULL, a symlink to the slave device is created there
+ * @return false if the pseudo terminal could not be opened
+ */
+bool cdcPtyInit(const char *linkPath);
+
+#endif //__CDC_PTY_H__
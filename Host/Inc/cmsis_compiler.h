@@ -0,0 +1,43 @@
+#ifndef __CMSIS_COMPILER_H
+#define __CMSIS_COMPILER_H
+
+/*
+ * Host build stand-in for the CMSIS core intrinsics used by cmsis_os2.c.
+ *
+ * Everything on the host runs in task context: the "interrupt" entry points
+ * of the application are called from ordinary FreeRTOS tasks, so the IPSR
+ * reads as zero and interrupts are never masked by the CPU itself.
+ */
+
+#include <stdint.h>
+
+#ifndef __STATIC_INLINE
+#define __STATIC_INLINE static inline
+#endif
+#ifndef __WEAK
+#define __WEAK __attribute__((weak))
+#endif
+#ifndef __NO_RETURN
+#define __NO_RETURN __attribute__((__noreturn__))
+#endif
+
+typedef int32_t IRQn_Type;
+
+__STATIC_INLINE uint32_t __get_IPSR(void) { return 0U; }
+__STATIC_INLINE uint32_t __get_PRIMASK(void) { return 0U; }
+__STATIC_INLINE uint32_t __get_BASEPRI(void) { return 0U; }
+__STATIC_INLINE void __disable_irq(void) { }
+__STATIC_INLINE void __enable_irq(void) { }
+__STATIC_INLINE void NVIC_SetPriority(IRQn_Type IRQn, uint32_t priority) { (void)IRQn; (void)priority; }
+
+typedef struct {
+  volatile uint32_t CTRL;
+  volatile uint32_t LOAD;
+  volatile uint32_t VAL;
+  volatile uint32_t CALIB;
+} SysTick_Type;
+
+/*! A variable rather than a macro, so cmsis_os2.c does not define SysTick_Handler */
+static SysTick_Type * const SysTick = &(SysTick_Type){ 0 };
+
+#endif /* __CMSIS_COMPILER_H */
@@ -0,0 +1,32 @@
+#ifndef __USBD_CDC_IF_H__
+#define __USBD_CDC_IF_H__
+
+/*
+ * Host build stand-in for the USB CDC interface. The same calls as
+ * USB_DEVICE/App/usbd_cdc_if.h, served by a pseudo terminal instead of the
+ * OTG_FS endpoint (see cdc_pty.c).
+ */
+
+#include <stdint.h>
+
+#define APP_RX_DATA_SIZE  2048
+#define APP_TX_DATA_SIZE  2048
+
+#define CDC_DATA_FS_MAX_PACKET_SIZE 64U
+
+typedef enum {
+  USBD_OK = 0U,
+  USBD_BUSY,
+  USBD_EMEM,
+  USBD_FAIL,
+} USBD_StatusTypeDef;
+
+extern uint8_t UserTxBufferFS[APP_TX_DATA_SIZE];
+
+uint8_t CDC_Transmit_FS(uint8_t* Buf, uint16_t Len);
+
+void CDC_ResumeReceive_FS(void);
+
+uint8_t CDC_IsConfigured_FS(void);
+
+#endif /* __USBD_CDC_IF_H__ */
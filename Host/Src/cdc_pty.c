@@ -0,0 +1,123 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <termios.h>
+
+#include "cdc_pty.h"
+#include "usblink.h"
+#include "static_mem.h"
+#include "task.h"
+
+#include "usbd_cdc_if.h"
+
+uint8_t UserTxBufferFS[APP_TX_DATA_SIZE];
+
+static int master = -1;
+/*! Kept open so reading the master does not fail while no client is attached */
+static int slave = -1;
+static volatile bool rxPaused;
+/*! Transfer handed over by CDC_Transmit_FS(), written out by cdcPtyTask */
+static uint8_t *txData;
+static uint32_t txLeft;
+
+STATIC_MEM_TASK_ALLOC(cdcPtyTask, CDC_PTY_TASK_STACKSIZE);
+
+/*! Called by usblink with its critical section held, like the USB interrupt would be masked */
+uint8_t CDC_Transmit_FS(uint8_t* Buf, uint16_t Len) {
+  if (txLeft)
+    return USBD_BUSY;
+
+  txData = Buf;
+  txLeft = Len;
+  return USBD_OK;
+}
+
+void CDC_ResumeReceive_FS(void) {
+  rxPaused = false;
+}
+
+/*! The pty exists for the whole run, like a cable that is never pulled */
+uint8_t CDC_IsConfigured_FS(void) {
+  return master >= 0;
+}
+
+static void cdcPtyTransmit(void) {
+  uint8_t *data;
+  uint32_t left;
+  ssize_t n;
+
+  taskENTER_CRITICAL();
+  data = txData;
+  left = txLeft;
+  taskEXIT_CRITICAL();
+
+  if (left == 0)
+    return;
+
+  n = write(master, data, left);
+  if (n <= 0)
+    return;
+
+  taskENTER_CRITICAL();
+  txData += n;
+  txLeft -= n;
+  left = txLeft;
+  taskEXIT_CRITICAL();
+
+  if (left == 0)
+    usblinkTxDoneFromISR();
+}
+
+static void cdcPtyReceive(void) {
+  uint8_t chunk[CDC_DATA_FS_MAX_PACKET_SIZE];
+  ssize_t n;
+
+  /*! One read per full speed packet, until the pty is empty or usblink pauses us */
+  while (!rxPaused) {
+    n = read(master, chunk, sizeof(chunk));
+    if (n <= 0)
+      break;
+    rxPaused = !usblinkReceiveFromISR(chunk, n);
+  }
+}
+
+/*! Stands in for the OTG_FS interrupt, polled once per tick */
+static void cdcPtyTask(void *param) {
+  while (1) {
+    cdcPtyTransmit();
+    cdcPtyReceive();
+    osDelay(1);
+  }
+}
+
+bool cdcPtyInit(const char *linkPath) {
+  struct termios tio;
+  const char *name;
+
+  master = posix_openpt(O_RDWR | O_NOCTTY);
+  if (master < 0 || grantpt(master) || unlockpt(master))
+    return false;
+
+  name = ptsname(master);
+  slave = open(name, O_RDWR | O_NOCTTY);
+  if (slave < 0)
+    return false;
+
+  /*! Raw mode, syslink frames are binary */
+  tcgetattr(slave, &tio);
+  cfmakeraw(&tio);
+  tcsetattr(slave, TCSANOW, &tio);
+  fcntl(master, F_SETFL, fcntl(master, F_GETFL) | O_NONBLOCK);
+
+  if (linkPath) {
+    unlink(linkPath);
+    if (symlink(name, linkPath))
+      perror(linkPath);
+  }
+  printf("USB CDC on %s\n", linkPath ? linkPath : name);
+
+  STATIC_MEM_TASK_CREATE(cdcPtyTask, cdcPtyTask, CDC_PTY_TASK_NAME, NULL, CDC_PTY_TASK_PRI);
+  return true;
+}
@@ -0,0 +1,22 @@
+#include <time.h>
+
+#include "cyclecounter.h"
+
+/*! The host counts nanoseconds, so one "cycle" is 1 ns whatever the CPU clock */
+void cycleCounterInit(void) {
+}
+
+uint32_t cycleCounterGet(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint32_t)ts.tv_sec * 1000000000U + (uint32_t)ts.tv_nsec;
+}
+
+uint32_t cycleCounterToUs(uint32_t cycles) {
+  return cycles / 1000;
+}
+
+uint32_t cycleCounterFromUs(uint32_t us) {
+  return us * 1000;
+}
@@ -0,0 +1,50 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "main.h"
+#include "tim.h"
+#include "usart.h"
+#include "config.h"
+#include "cmsis_os2.h"
+
+uint32_t SystemCoreClock = 168000000;
+
+/*! Register values as left by MX_TIM1_Init() and MX_TIM2_Init() */
+static TIM_TypeDef tim1 = { .PSC = 167, .ARR = 999 };
+static TIM_TypeDef tim2 = { .PSC = 83, .ARR = 999 };
+
+TIM_HandleTypeDef htim1 = { .Instance = &tim1 };
+TIM_HandleTypeDef htim2 = { .Instance = &tim2 };
+UART_HandleTypeDef huart2 = { .fd = STDOUT_FILENO };
+
+HAL_StatusTypeDef HAL_TIM_PWM_Start(TIM_HandleTypeDef *htim, uint32_t Channel) {
+  htim->Instance->CCER |= 1U << Channel;
+  htim->Instance->CR1 |= 1U;
+  return HAL_OK;
+}
+
+/*! APB2 and APB1 timer clocks of SystemClock_Config() */
+uint32_t timGetClockFreq(TIM_HandleTypeDef *htim) {
+  return htim == &htim1 ? SystemCoreClock : SystemCoreClock / 2;
+}
+
+HAL_StatusTypeDef HAL_UART_Transmit(UART_HandleTypeDef *huart, uint8_t *pData, uint16_t Size, uint32_t Timeout) {
+  return write(huart->fd, pData, Size) == Size ? HAL_OK : HAL_ERROR;
+}
+
+void HAL_Delay(uint32_t Delay) {
+  osDelay(Delay);
+}
+
+uint32_t HAL_GetTick(void) {
+  return osKernelGetTickCount();
+}
+
+void HAL_NVIC_SystemReset(void) {
+  abort();
+}
+
+void Error_Handler(void) {
+  abort();
+}
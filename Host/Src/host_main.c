@@ -0,0 +1,36 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "FreeRTOS.h"
+#include "cmsis_os2.h"
+
+#include "system.h"
+#include "car_driver.h"
+#include "cdc_pty.h"
+
+/*
+ * Host build entry point, the equivalent of main() and MX_FREERTOS_Init() on
+ * the board: the application is started the same way, only the USB endpoint
+ * is a pseudo terminal.
+ *
+ * Usage: carhost [link]  where link is an optional symlink to the pty.
+ */
+int main(int argc, char **argv) {
+  setvbuf(stdout, NULL, _IONBF, 0);
+
+  osKernelInitialize();
+  if (!cdcPtyInit(argc > 1 ? argv[1] : NULL)) {
+    perror("pty");
+    return EXIT_FAILURE;
+  }
+  motorInit();
+  systemLaunch();
+  osKernelStart();
+
+  return EXIT_FAILURE;
+}
+
+void vAssertCalled(const char *file, int line) {
+  fprintf(stderr, "FreeRTOS assert failed %s:%d\n", file, line);
+  abort();
+}
@@ -0,0 +1,170 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "FreeRTOS.h"
+#include "cmsis_os2.h"
+
+#include "crtp.h"
+#include "crtp_pool.h"
+
+/*
+ * Receive path benchmark, by value against by pool handle.
+ *
+ * Both paths take one USB OUT transfer to the setpoint consumer through the
+ * same three FreeRTOS queues as the firmware: link delivery, port queue and
+ * consumer. The by-value path is the one before the pool: the USB handler
+ * copies into a static packet and every queue holds whole CRTPPackets, which
+ * FreeRTOS copies in on put and out on get. The pool path copies once into a
+ * pool packet and only moves its pointer, the consumer reads it in place.
+ *
+ * Everything runs in one task, so the figures are the CPU cost of the path
+ * without scheduling. Packet copies count the copies of a whole packet, bytes
+ * moved also count the pointers.
+ *
+ * Usage: poolbench [packets]
+ */
+
+#define POOLBENCH_HOPS 3
+#define POOLBENCH_QUEUE_SIZE 16
+#define POOLBENCH_DEFAULT_PACKETS 2000000
+
+typedef struct {
+  const char *name;
+  double seconds;
+  int copies;                 //< Whole packet copies per packet
+  uint64_t bytesMoved;
+  uint32_t checksum;          //< Keeps the consumer from being optimised away
+} PoolbenchResult;
+
+/*! Read by the CMSIS wrapper, normally from hal_stub.c which this benchmark does without */
+uint32_t SystemCoreClock = 168000000;
+
+static uint32_t packets = POOLBENCH_DEFAULT_PACKETS;
+static uint8_t transfer[CRTP_MAX_DATA_SIZE + 1];
+
+static double now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void poolbenchTransfer(uint32_t i) {
+  transfer[0] = CRTP_HEADER(CRTP_PORT_SETPOINT, 0);
+  memcpy(&transfer[1], &i, sizeof(i));
+}
+
+static void poolbenchByValue(PoolbenchResult *r) {
+  osMessageQueueId_t queue[POOLBENCH_HOPS];
+  static CRTPPacket usbPacket;
+  CRTPPacket p;
+  double start;
+
+  for (int h = 0; h < POOLBENCH_HOPS; h++)
+    queue[h] = osMessageQueueNew(POOLBENCH_QUEUE_SIZE, sizeof(CRTPPacket), NULL);
+
+  start = now();
+  for (uint32_t i = 0; i < packets; i++) {
+    poolbenchTransfer(i);
+    usbPacket.size = sizeof(transfer) - 1;
+    memcpy(usbPacket.raw, transfer, sizeof(transfer));
+    for (int h = 0; h < POOLBENCH_HOPS; h++) {
+      osMessageQueuePut(queue[h], h == 0 ? &usbPacket : &p, 0, 0);
+      osMessageQueueGet(queue[h], &p, NULL, 0);
+    }
+    r->checksum += p.data[0];
+  }
+  r->seconds = now() - start;
+
+  /*! Into the static packet, then in and out of every queue */
+  r->name = "by value";
+  r->copies = 1 + 2 * POOLBENCH_HOPS;
+  r->bytesMoved = (uint64_t)packets * (sizeof(transfer) + sizeof(CRTPPacket) * 2 * POOLBENCH_HOPS);
+  for (int h = 0; h < POOLBENCH_HOPS; h++)
+    osMessageQueueDelete(queue[h]);
+}
+
+static void poolbenchByHandle(PoolbenchResult *r) {
+  osMessageQueueId_t queue[POOLBENCH_HOPS];
+  CRTPPacket *p;
+  double start;
+
+  for (int h = 0; h < POOLBENCH_HOPS; h++)
+    queue[h] = osMessageQueueNew(POOLBENCH_QUEUE_SIZE, sizeof(CRTPPacket *), NULL);
+
+  start = now();
+  for (uint32_t i = 0; i < packets; i++) {
+    poolbenchTransfer(i);
+    p = crtpPoolAlloc();
+    p->size = sizeof(transfer) - 1;
+    memcpy(p->raw, transfer, sizeof(transfer));
+    for (int h = 0; h < POOLBENCH_HOPS; h++) {
+      osMessageQueuePut(queue[h], &p, 0, 0);
+      osMessageQueueGet(queue[h], &p, NULL, 0);
+    }
+    r->checksum += p->data[0];
+    crtpPoolFree(p);
+  }
+  r->seconds = now() - start;
+
+  r->name = "by handle";
+  r->copies = 1;
+  r->bytesMoved = (uint64_t)packets * (sizeof(transfer) + sizeof(CRTPPacket *) * 2 * POOLBENCH_HOPS);
+  for (int h = 0; h < POOLBENCH_HOPS; h++)
+    osMessageQueueDelete(queue[h]);
+}
+
+static void poolbenchReport(const PoolbenchResult *r) {
+  printf("%-10s %10.0f packets/s %6.1f ns/packet %d packet copies %4llu bytes moved (checksum %u)\n",
+         r->name, packets / r->seconds, r->seconds * 1e9 / packets, r->copies,
+         (unsigned long long)(r->bytesMoved / packets), r->checksum);
+}
+
+static void poolbenchTask(void *param) {
+  PoolbenchResult value = { 0 }, handle = { 0 };
+
+  crtpPoolInit();
+  /*! Warm up both paths once, then measure */
+  poolbenchByValue(&value);
+  poolbenchByHandle(&handle);
+  value = (PoolbenchResult){ 0 };
+  handle = (PoolbenchResult){ 0 };
+  poolbenchByValue(&value);
+  poolbenchByHandle(&handle);
+
+  printf("%u setpoint packets, %d queue hops, CRTPPacket %zu bytes\n", packets, POOLBENCH_HOPS, sizeof(CRTPPacket));
+  poolbenchReport(&value);
+  poolbenchReport(&handle);
+  printf("speedup %.2fx\n", value.seconds / handle.seconds);
+  exit(EXIT_SUCCESS);
+}
+
+int main(int argc, char **argv) {
+  static const osThreadAttr_t attr = { .name = "POOLBENCH" };
+
+  setvbuf(stdout, NULL, _IONBF, 0);
+  if (argc > 1)
+    packets = strtoul(argv[1], NULL, 0);
+  if (packets == 0) {
+    fprintf(stderr, "Usage: %s [packets]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  osKernelInitialize();
+  osThreadNew(poolbenchTask, NULL, &attr);
+  osKernelStart();
+
+  return EXIT_FAILURE;
+}
+
+void vAssertCalled(const char *file, int line) {
+  fprintf(stderr, "FreeRTOS assert failed %s:%d\n", file, line);
+  abort();
+}
+
+void assertFail(char *exp, char *file, int line) {
+  fprintf(stderr, "Assert failed %s:%d\n", file, line);
+  abort();
+}
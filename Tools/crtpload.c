@@ -0,0 +1,445 @@
+/*
+ * crtpload - CRTP load generator and latency benchmark.
+ *
+ * Connects to the USB CDC device of the car, or to the pty of the host build,
+ * and sends a mix of setpoint, echo and bulk (link sink) traffic at fixed
+ * rates. At the end it reports per port throughput and loss, using the port
+ * counters of the link service, the echo round trip percentiles and the
+ * latency histograms of the firmware. With -m it also runs the motor mixer
+ * benchmark of the firmware, integer path against the float reference.
+ *
+ * Usage: crtpload [-s rate] [-e rate] [-E size] [-b rate] [-t seconds] [-m samples] device
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "crtp.h"
+#include "crtpservice.h"
+#include "syslink.h"
+
+#define ECHO_HEADER_SIZE 12     //< Sequence number and send time
+#define OUT_BUFFER_SIZE 4096
+#define QUERY_TIMEOUT_NS 500000000LL
+
+typedef struct {
+  const char *name;
+  uint8_t header;
+  double rate;                  //< Packets per second, 0 to disable
+  int size;                     //< Data bytes per packet
+  int64_t period;
+  int64_t next;
+  uint32_t sent;
+  uint64_t bytes;
+} Stream;
+
+enum { STREAM_SETPOINT, STREAM_ECHO, STREAM_BULK, STREAM_COUNT };
+
+static Stream streams[STREAM_COUNT] = {
+  [STREAM_SETPOINT] = { "setpoint", CRTP_HEADER(CRTP_PORT_SETPOINT, 0), 100, 14 },
+  [STREAM_ECHO]     = { "echo", CRTP_HEADER(CRTP_PORT_LINK, CRTP_SRV_LINK_ECHO), 100, ECHO_HEADER_SIZE },
+  [STREAM_BULK]     = { "bulk", CRTP_HEADER(CRTP_PORT_LINK, CRTP_SRV_LINK_SINK), 0, CRTP_MAX_DATA_SIZE },
+};
+
+static int fd;
+static uint8_t out[OUT_BUFFER_SIZE];
+static size_t outLen;
+static SyslinkParser parser;
+static uint32_t linkQueries;
+
+static int64_t *rtt;
+static size_t rttCount, rttSize;
+static uint32_t echoReceived;
+
+/*! Stats channel replies not yet consumed, a histogram answer spans several packets */
+#define REPLY_QUEUE_SIZE 8
+
+typedef struct {
+  uint8_t size;
+  uint8_t data[CRTP_MAX_DATA_SIZE];
+} Reply;
+
+static Reply replies[REPLY_QUEUE_SIZE];
+static unsigned replyHead, replyTail;
+
+static int64_t now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int openLink(const char *path) {
+  struct termios tio;
+  int f = open(path, O_RDWR | O_NOCTTY | O_NONBLOCK);
+
+  if (f < 0)
+    return -1;
+  if (tcgetattr(f, &tio) == 0) {
+    cfmakeraw(&tio);
+    tcsetattr(f, TCSANOW, &tio);
+  }
+  return f;
+}
+
+static void flush(void) {
+  ssize_t n;
+
+  while (outLen) {
+    n = write(fd, out, outLen);
+    if (n <= 0)
+      return;
+    memmove(out, out + n, outLen - n);
+    outLen -= n;
+  }
+}
+
+/*! Queue one packet, false if the link is not keeping up */
+static bool sendPacket(uint8_t header, const uint8_t *data, int size) {
+  uint8_t raw[CRTP_MAX_DATA_SIZE + 1];
+  int n;
+
+  raw[0] = header;
+  memcpy(&raw[1], data, size);
+  n = syslinkEncode(&out[outLen], sizeof(out) - outLen, SYSLINK_RADIO_RAW, raw, size + 1);
+  if (n <= 0)
+    return false;
+  outLen += n;
+  if ((header >> 4) == CRTP_PORT_LINK && (header & 0x03) == CRTP_SRV_LINK_STATS)
+    linkQueries++;
+  return true;
+}
+
+static void handlePacket(const uint8_t *raw, int length) {
+  uint8_t port = raw[0] >> 4;
+  uint8_t channel = raw[0] & 0x03;
+  const uint8_t *data = &raw[1];
+  int size = length - 1;
+
+  if (port != CRTP_PORT_LINK)
+    return;
+
+  if (channel == CRTP_SRV_LINK_ECHO && size >= ECHO_HEADER_SIZE) {
+    int64_t sent;
+
+    memcpy(&sent, &data[4], sizeof(sent));
+    if (rttCount == rttSize) {
+      rttSize = rttSize ? 2 * rttSize : 4096;
+      rtt = realloc(rtt, rttSize * sizeof(*rtt));
+    }
+    rtt[rttCount++] = now() - sent;
+    echoReceived++;
+  } else if (channel == CRTP_SRV_LINK_STATS && size >= 1) {
+    if (replyHead - replyTail == REPLY_QUEUE_SIZE)
+      replyTail++;
+    replies[replyHead % REPLY_QUEUE_SIZE].size = size;
+    memcpy(replies[replyHead % REPLY_QUEUE_SIZE].data, data, size);
+    replyHead++;
+  }
+}
+
+static void receive(void) {
+  uint8_t buf[512];
+  ssize_t n;
+
+  while ((n = read(fd, buf, sizeof(buf))) > 0) {
+    for (ssize_t i = 0; i < n; i++) {
+      if (syslinkParseByte(&parser, buf[i]) && parser.packet.type == SYSLINK_RADIO_RAW &&
+          parser.packet.length >= 1)
+        handlePacket(parser.packet.data, parser.packet.length);
+    }
+  }
+}
+
+static void pump(int timeoutMs) {
+  struct pollfd pfd = { .fd = fd, .events = POLLIN | (outLen ? POLLOUT : 0) };
+
+  poll(&pfd, 1, timeoutMs);
+  receive();
+  flush();
+}
+
+/*! Wait for the next stats reply carrying 'command', older replies are skipped */
+static Reply *waitReply(uint8_t command) {
+  int64_t deadline = now() + QUERY_TIMEOUT_NS;
+
+  while (now() < deadline) {
+    while (replyTail != replyHead) {
+      Reply *r = &replies[replyTail++ % REPLY_QUEUE_SIZE];
+      if (r->data[0] == command)
+        return r;
+    }
+    pump(10);
+  }
+  return NULL;
+}
+
+/*! Send a stats request and wait for the reply carrying 'command' */
+static Reply *query(const uint8_t *request, int size, uint8_t command) {
+  replyTail = replyHead;
+  if (!sendPacket(CRTP_HEADER(CRTP_PORT_LINK, CRTP_SRV_LINK_STATS), request, size))
+    return NULL;
+  return waitReply(command);
+}
+
+static bool queryPort(uint8_t port, CrtpSrvPortStats *stats) {
+  uint8_t request[] = { CRTP_SRV_STATS_PORT, port };
+  Reply *r = query(request, sizeof(request), CRTP_SRV_STATS_PORT);
+
+  if (!r || r->size < sizeof(*stats))
+    return false;
+  memcpy(stats, r->data, sizeof(*stats));
+  return true;
+}
+
+static bool queryHistogram(uint8_t id, CrtpSrvHistogramSummary *summary, uint32_t *bins) {
+  uint8_t request[] = { CRTP_SRV_STATS_HISTOGRAM, id };
+  CrtpSrvHistogramBins part;
+  int received = 0, n;
+  Reply *r = query(request, sizeof(request), CRTP_SRV_STATS_HISTOGRAM);
+
+  if (!r || r->size < sizeof(*summary))
+    return false;
+  memcpy(summary, r->data, sizeof(*summary));
+
+  while (received < HISTOGRAM_BINS) {
+    r = waitReply(CRTP_SRV_STATS_HISTOGRAM_BINS);
+    if (!r || r->size < 3)
+      return false;
+    memcpy(&part, r->data, r->size);
+    n = (r->size - 3) / sizeof(uint32_t);
+    if (part.first + n > HISTOGRAM_BINS)
+      return false;
+    memcpy(&bins[part.first], part.bins, n * sizeof(uint32_t));
+    received += n;
+  }
+  return true;
+}
+
+static int compare(const void *a, const void *b) {
+  int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+  return (x > y) - (x < y);
+}
+
+static double percentile(double p) {
+  size_t i = (size_t)(p * (rttCount - 1) + 0.5);
+  return rtt[i] / 1000.0;
+}
+
+/*! Upper bound of the bin holding the p-th sample, the last bin is open ended */
+static uint32_t histogramPercentile(const CrtpSrvHistogramSummary *s, const uint32_t *bins, double p) {
+  uint64_t target = (uint64_t)(p * s->count + 0.5), seen = 0;
+
+  for (int i = 0; i < HISTOGRAM_BINS - 1; i++) {
+    seen += bins[i];
+    if (seen >= target)
+      return (i + 1) * s->binWidth < s->max ? (i + 1) * s->binWidth : s->max;
+  }
+  return s->max;
+}
+
+static void reportLatency(void) {
+  static const char *names[CRTP_SRV_HIST_COUNT] = {
+    [LATENCY_USB_TO_DISPATCH]         = "usb -> dispatch",
+    [LATENCY_DISPATCH_TO_CONTROLLER]  = "dispatch -> controller",
+    [LATENCY_CONTROLLER_TO_PWM]       = "controller -> pwm",
+    [LATENCY_TOTAL]                   = "usb -> pwm",
+    [CRTP_SRV_HIST_CONTROLLER_JITTER] = "control period jitter",
+    [CRTP_SRV_HIST_CONTROLLER_EXEC]   = "control loop exec",
+  };
+  CrtpSrvHistogramSummary s;
+  uint32_t bins[HISTOGRAM_BINS];
+
+  printf("\nfirmware histograms (us)       count     min    mean    p50<=   p99<=     max\n");
+  for (int id = 0; id < CRTP_SRV_HIST_COUNT; id++) {
+    if (!queryHistogram(id, &s, bins)) {
+      printf("%-26s  no reply\n", names[id]);
+      continue;
+    }
+    if (s.count == 0) {
+      printf("%-26s %9u\n", names[id], 0);
+      continue;
+    }
+    printf("%-26s %9u %7u %7u %8u %7u %7u\n", names[id], s.count, s.min, s.mean,
+           histogramPercentile(&s, bins, 0.5), histogramPercentile(&s, bins, 0.99), s.max);
+  }
+}
+
+static void reportLink(void) {
+  uint8_t request[] = { CRTP_SRV_STATS_LINK };
+  Reply *r = query(request, sizeof(request), CRTP_SRV_STATS_LINK);
+  CrtpSrvLinkStats l;
+
+  if (!r || r->size < sizeof(l))
+    return;
+  memcpy(&l, r->data, sizeof(l));
+  printf("\nlink: tx lane high water %u/%u/%u, delivery high water %u, pool min free %u\n",
+         l.txHighWater[0], l.txHighWater[1], l.txHighWater[2], l.deliveryHighWater, l.poolMinFree);
+  printf("      busy retries %u, transfer waits %u, usb rx dropped %u, frame errors %u\n",
+         l.linkRetries, l.linkWaits, l.usbRxDropped, l.usbRxErrors);
+}
+
+static void reportMotorBench(uint16_t samples) {
+  uint8_t request[] = { CRTP_SRV_STATS_MOTOR_BENCH, samples & 0xFF, samples >> 8 };
+  Reply *r = query(request, sizeof(request), CRTP_SRV_STATS_MOTOR_BENCH);
+  CrtpSrvMotorBench b;
+
+  if (!r || r->size < sizeof(b)) {
+    printf("\nmotor bench: no reply\n");
+    return;
+  }
+  memcpy(&b, r->data, sizeof(b));
+  if (b.samples == 0)
+    return;
+  printf("\nmotor bench: %u setpoints, cycles per setpoint float %.1f, fixed %.1f (%.2fx)\n",
+         b.samples, (double)b.floatCycles / b.samples, (double)b.fixedCycles / b.samples,
+         b.fixedCycles ? (double)b.floatCycles / b.fixedCycles : 0.0);
+  printf("             command mismatches %u (max error %u), saturation %u, compare %u\n",
+         b.commandMismatches, b.maxCommandError, b.saturationMismatches, b.compareMismatches);
+}
+
+static void usage(const char *name) {
+  fprintf(stderr, "Usage: %s [-s rate] [-e rate] [-E size] [-b rate] [-t seconds] [-m samples] device\n"
+                  "  -s  setpoint packets per second (%.0f)\n"
+                  "  -e  echo packets per second (%.0f)\n"
+                  "  -E  echo packet size, %d to %d bytes (%d)\n"
+                  "  -b  bulk packets per second to the link sink (%.0f)\n"
+                  "  -t  duration in seconds (10)\n"
+                  "  -m  motor mixer benchmark over this many setpoints, up to 65535 (off)\n",
+          name, streams[STREAM_SETPOINT].rate, streams[STREAM_ECHO].rate,
+          ECHO_HEADER_SIZE, CRTP_MAX_DATA_SIZE, streams[STREAM_ECHO].size, streams[STREAM_BULK].rate);
+  exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv) {
+  CrtpSrvPortStats before[2], after[2];
+  const uint8_t ports[2] = { CRTP_PORT_SETPOINT, CRTP_PORT_LINK };
+  double duration = 10;
+  uint8_t data[CRTP_MAX_DATA_SIZE] = { 0 };
+  int64_t start, end, t;
+  uint32_t queriesBefore;
+  long benchSamples = 0;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "s:e:E:b:t:m:")) != -1) {
+    switch (opt) {
+      case 's': streams[STREAM_SETPOINT].rate = atof(optarg); break;
+      case 'e': streams[STREAM_ECHO].rate = atof(optarg); break;
+      case 'E': streams[STREAM_ECHO].size = atoi(optarg); break;
+      case 'b': streams[STREAM_BULK].rate = atof(optarg); break;
+      case 't': duration = atof(optarg); break;
+      case 'm': benchSamples = atol(optarg); break;
+      default: usage(argv[0]);
+    }
+  }
+  if (optind != argc - 1 || streams[STREAM_ECHO].size < ECHO_HEADER_SIZE ||
+      streams[STREAM_ECHO].size > CRTP_MAX_DATA_SIZE || benchSamples < 0 || benchSamples > 0xFFFF)
+    usage(argv[0]);
+
+  fd = openLink(argv[optind]);
+  if (fd < 0) {
+    perror(argv[optind]);
+    return EXIT_FAILURE;
+  }
+  syslinkParserInit(&parser);
+
+  for (int i = 0; i < 2; i++) {
+    if (!queryPort(ports[i], &before[i])) {
+      fprintf(stderr, "%s: no answer from the link service\n", argv[optind]);
+      return EXIT_FAILURE;
+    }
+  }
+  queriesBefore = linkQueries;
+
+  start = now();
+  end = start + (int64_t)(duration * 1e9);
+  for (int i = 0; i < STREAM_COUNT; i++) {
+    streams[i].period = streams[i].rate > 0 ? (int64_t)(1e9 / streams[i].rate) : 0;
+    streams[i].next = start;
+  }
+
+  /* A stream that falls behind sends what it can, the achieved rate shows it */
+  while ((t = now()) < end) {
+    int64_t wake = end;
+
+    for (int i = 0; i < STREAM_COUNT; i++) {
+      Stream *s = &streams[i];
+
+      if (!s->period)
+        continue;
+      if (t >= s->next) {
+        if (i == STREAM_SETPOINT) {
+          float sp[3] = { 0.0f, 0.5f, 0.0f };
+          uint16_t thrust = 100;
+          memcpy(data, sp, sizeof(sp));
+          memcpy(&data[sizeof(sp)], &thrust, sizeof(thrust));
+        } else if (i == STREAM_ECHO) {
+          memcpy(&data[0], &s->sent, sizeof(s->sent));
+          memcpy(&data[4], &t, sizeof(t));
+        }
+        if (sendPacket(s->header, data, s->size)) {
+          s->sent++;
+          s->bytes += s->size + 1;
+          s->next += s->period;
+          if (s->next < t - 100000000LL)
+            s->next = t;
+        }
+      }
+      if (s->next < wake)
+        wake = s->next;
+    }
+
+    t = now();
+    pump(wake > t ? (int)((wake - t) / 1000000) : 0);
+  }
+
+  /* Let the last echoes come back */
+  for (int64_t drain = now() + 200000000LL; now() < drain; )
+    pump(10);
+
+  for (int i = 0; i < 2; i++)
+    queryPort(ports[i], &after[i]);
+
+  printf("%-10s %9s %9s %9s\n", "stream", "sent", "pkt/s", "kB/s");
+  for (int i = 0; i < STREAM_COUNT; i++) {
+    printf("%-10s %9u %9.1f %9.2f\n", streams[i].name, streams[i].sent,
+           streams[i].sent / duration, streams[i].bytes / duration / 1000.0);
+  }
+
+  /* The link port also counted the queries sent since its 'before' snapshot */
+  uint32_t sentOnPort[2] = {
+    streams[STREAM_SETPOINT].sent,
+    streams[STREAM_ECHO].sent + streams[STREAM_BULK].sent + (linkQueries - queriesBefore),
+  };
+  printf("\n%-10s %9s %9s %9s %9s\n", "port", "sent", "fw rx", "lost", "fw drop");
+  for (int i = 0; i < 2; i++) {
+    uint32_t rx = after[i].rxPackets - before[i].rxPackets;
+    printf("%-10u %9u %9u %9d %9u\n", ports[i], sentOnPort[i], rx, (int)(sentOnPort[i] - rx),
+           after[i].rxDropped - before[i].rxDropped);
+  }
+
+  if (streams[STREAM_ECHO].sent) {
+    printf("\necho: %u of %u returned (%.2f%% loss)", echoReceived, streams[STREAM_ECHO].sent,
+           100.0 * (streams[STREAM_ECHO].sent - echoReceived) / streams[STREAM_ECHO].sent);
+    if (rttCount) {
+      qsort(rtt, rttCount, sizeof(*rtt), compare);
+      printf(", rtt us p50 %.0f p90 %.0f p99 %.0f max %.0f", percentile(0.5), percentile(0.9),
+             percentile(0.99), percentile(1.0));
+    }
+    printf("\n");
+  }
+
+  reportLink();
+  reportLatency();
+  if (benchSamples)
+    reportMotorBench(benchSamples);
+
+  close(fd);
+  return EXIT_SUCCESS;
+}
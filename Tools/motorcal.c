@@ -0,0 +1,388 @@
+/*
+ * motorcal - motor calibration tables of the car.
+ *
+ * Connects to the USB CDC device of the car, or to the pty of the host build.
+ * It saves the tables of all motors to a text file and loads them back, and
+ * runs calibration sweeps. During a sweep the car steps the output of one
+ * motor and waits at every step for the measured response, e.g. the wheel
+ * speed from a tachometer, which is typed in (or piped in) on stdin.
+ *
+ * File format: one line per table, "motor direction point0 ... point16",
+ * direction 0 forward and 1 backward. Lines starting with '#' are comments.
+ *
+ * Usage: motorcal [-R] [-w file] [-s motor:direction] [-n steps] [-d ms] [-r file] device
+ * The actions run in that order, so "-s 0:0 -r cal.txt" saves the result.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "crtp.h"
+#include "crtpservice.h"
+#include "motorcal.h"
+#include "syslink.h"
+
+#define OUT_BUFFER_SIZE 1024
+#define REPLY_TIMEOUT_NS 1000000000LL
+/*! Keeps the link active while waiting for the user, it sends no setpoint that would abort the sweep */
+#define KEEPALIVE_MS 200
+#define REPLY_QUEUE_SIZE 8
+
+typedef struct {
+  uint8_t size;
+  uint8_t data[CRTP_MAX_DATA_SIZE];
+} Reply;
+
+static int fd;
+static uint8_t out[OUT_BUFFER_SIZE];
+static size_t outLen;
+static SyslinkParser parser;
+static Reply replies[REPLY_QUEUE_SIZE];
+static unsigned replyHead, replyTail;
+
+static const char *statusNames[] = {
+  [MOTORCAL_OK]             = "ok",
+  [MOTORCAL_ERROR_LENGTH]   = "bad length",
+  [MOTORCAL_ERROR_INDEX]    = "bad motor, direction or point",
+  [MOTORCAL_ERROR_TABLE]    = "table not increasing or out of range",
+  [MOTORCAL_ERROR_BUSY]     = "sweep running",
+  [MOTORCAL_ERROR_TIMEOUT]  = "no response in time",
+  [MOTORCAL_ERROR_RESPONSE] = "response did not rise",
+  [MOTORCAL_ERROR_ABORTED]  = "aborted",
+  [MOTORCAL_ERROR_COMMAND]  = "unknown command",
+};
+
+static int64_t now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static const char *statusName(uint8_t status) {
+  return status < sizeof(statusNames) / sizeof(statusNames[0]) ? statusNames[status] : "?";
+}
+
+static int openLink(const char *path) {
+  struct termios tio;
+  int f = open(path, O_RDWR | O_NOCTTY | O_NONBLOCK);
+
+  if (f < 0)
+    return -1;
+  if (tcgetattr(f, &tio) == 0) {
+    cfmakeraw(&tio);
+    tcsetattr(f, TCSANOW, &tio);
+  }
+  return f;
+}
+
+static void flush(void) {
+  ssize_t n;
+
+  while (outLen) {
+    n = write(fd, out, outLen);
+    if (n <= 0)
+      return;
+    memmove(out, out + n, outLen - n);
+    outLen -= n;
+  }
+}
+
+static bool sendPacket(uint8_t header, const void *data, int size) {
+  uint8_t raw[CRTP_MAX_DATA_SIZE + 1];
+  int n;
+
+  raw[0] = header;
+  memcpy(&raw[1], data, size);
+  n = syslinkEncode(&out[outLen], sizeof(out) - outLen, SYSLINK_RADIO_RAW, raw, size + 1);
+  if (n <= 0)
+    return false;
+  outLen += n;
+  flush();
+  return true;
+}
+
+static bool sendCommand(const void *data, int size) {
+  return sendPacket(CRTP_HEADER(CRTP_PORT_MEM, 0), data, size);
+}
+
+static void receive(void) {
+  uint8_t buf[512];
+  ssize_t n;
+
+  while ((n = read(fd, buf, sizeof(buf))) > 0) {
+    for (ssize_t i = 0; i < n; i++) {
+      if (!syslinkParseByte(&parser, buf[i]) || parser.packet.type != SYSLINK_RADIO_RAW ||
+          parser.packet.length < 2 || parser.packet.data[0] != CRTP_HEADER(CRTP_PORT_MEM, 0))
+        continue;
+      if (replyHead - replyTail == REPLY_QUEUE_SIZE)
+        replyTail++;
+      replies[replyHead % REPLY_QUEUE_SIZE].size = parser.packet.length - 1;
+      memcpy(replies[replyHead % REPLY_QUEUE_SIZE].data, &parser.packet.data[1], parser.packet.length - 1);
+      replyHead++;
+    }
+  }
+}
+
+/*! Next packet, or NULL after 'timeout' ns. Keeps the link alive meanwhile */
+static Reply *waitAny(int64_t timeout) {
+  int64_t deadline = now() + timeout;
+  struct pollfd pfd = { .fd = fd, .events = POLLIN };
+
+  while (replyTail == replyHead) {
+    if (now() >= deadline)
+      return NULL;
+    if (poll(&pfd, 1, KEEPALIVE_MS) == 0)
+      sendPacket(CRTP_HEADER(CRTP_PORT_LINK, CRTP_SRV_LINK_SINK), NULL, 0);
+    receive();
+  }
+  return &replies[replyTail++ % REPLY_QUEUE_SIZE];
+}
+
+/*! Next packet carrying 'command', or NULL after 'timeout' ns */
+static Reply *waitReply(uint8_t command, int64_t timeout) {
+  int64_t deadline = now() + timeout;
+  Reply *r;
+
+  while ((r = waitAny(deadline - now())) && r->data[0] != command)
+    ;
+  return r;
+}
+
+/*! Send a command answered with [command, status], false with a message if it failed */
+static bool command(const void *data, int size, const char *what) {
+  uint8_t cmd = ((const uint8_t *)data)[0];
+  Reply *r;
+
+  replyTail = replyHead;
+  if (!sendCommand(data, size) || !(r = waitReply(cmd, REPLY_TIMEOUT_NS))) {
+    fprintf(stderr, "%s: no answer\n", what);
+    return false;
+  }
+  if (r->data[1] != MOTORCAL_OK) {
+    fprintf(stderr, "%s: %s\n", what, statusName(r->data[1]));
+    return false;
+  }
+  return true;
+}
+
+static bool readTable(uint8_t motor, uint8_t direction, MotorLut *lut) {
+  MotorcalChunk chunk = { .command = MOTORCAL_CMD_READ, .motor = motor, .direction = direction };
+  Reply *r;
+
+  for (int first = 0; first < MOTOR_LUT_POINTS; first += MOTORCAL_CHUNK_POINTS) {
+    chunk.first = first;
+    replyTail = replyHead;
+    if (!sendCommand(&chunk, offsetof(MotorcalChunk, points)) ||
+        !(r = waitReply(MOTORCAL_CMD_READ, REPLY_TIMEOUT_NS)) || r->size < offsetof(MotorcalChunk, points) ||
+        r->data[1] != MOTORCAL_OK) {
+      fprintf(stderr, "read motor %u direction %u: failed\n", motor, direction);
+      return false;
+    }
+    memcpy(&lut->point[first], &r->data[offsetof(MotorcalChunk, points)], r->size - offsetof(MotorcalChunk, points));
+  }
+  return true;
+}
+
+static bool writeTable(uint8_t motor, uint8_t direction, const MotorLut *lut) {
+  MotorcalChunk chunk = { .command = MOTORCAL_CMD_WRITE, .motor = motor, .direction = direction };
+  uint8_t apply[] = { MOTORCAL_CMD_APPLY, motor, direction };
+  int n;
+
+  for (int first = 0; first < MOTOR_LUT_POINTS; first += n) {
+    n = MOTOR_LUT_POINTS - first < MOTORCAL_CHUNK_POINTS ? MOTOR_LUT_POINTS - first : MOTORCAL_CHUNK_POINTS;
+    chunk.first = first;
+    memcpy(chunk.points, &lut->point[first], n * sizeof(uint16_t));
+    if (!command(&chunk, offsetof(MotorcalChunk, points) + n * sizeof(uint16_t), "write"))
+      return false;
+  }
+  return command(apply, sizeof(apply), "apply");
+}
+
+static bool save(const char *path) {
+  FILE *f = fopen(path, "w");
+  MotorLut lut;
+
+  if (!f) {
+    perror(path);
+    return false;
+  }
+  fprintf(f, "# motor direction points, from a command just above 0 to full scale\n");
+  for (int motor = 0; motor < MOTOR_NBR; motor++) {
+    for (int direction = 0; direction < 2; direction++) {
+      if (!readTable(motor, direction, &lut)) {
+        fclose(f);
+        return false;
+      }
+      fprintf(f, "%d %d", motor, direction);
+      for (int i = 0; i < MOTOR_LUT_POINTS; i++)
+        fprintf(f, " %u", lut.point[i]);
+      fprintf(f, "\n");
+    }
+  }
+  return fclose(f) == 0;
+}
+
+static bool load(const char *path) {
+  FILE *f = fopen(path, "r");
+  char line[512];
+  int tables = 0;
+
+  if (!f) {
+    perror(path);
+    return false;
+  }
+  while (fgets(line, sizeof(line), f)) {
+    MotorLut lut;
+    char *p = line, *end;
+    long motor, direction, value;
+
+    if (line[0] == '#' || line[strspn(line, " \t\r\n")] == '\0')
+      continue;
+    motor = strtol(p, &end, 10);
+    direction = strtol(end, &end, 10);
+    for (int i = 0; i < MOTOR_LUT_POINTS; i++) {
+      p = end;
+      value = strtol(p, &end, 10);
+      if (end == p || value < 0 || value >= MOTOR_MAX_THRUST) {
+        fprintf(stderr, "%s: bad line: %s", path, line);
+        fclose(f);
+        return false;
+      }
+      lut.point[i] = value;
+    }
+    if (motor < 0 || motor >= MOTOR_NBR || direction < 0 || direction > 1) {
+      fprintf(stderr, "%s: bad line: %s", path, line);
+      fclose(f);
+      return false;
+    }
+    if (!writeTable(motor, direction, &lut)) {
+      fclose(f);
+      return false;
+    }
+    tables++;
+  }
+  fclose(f);
+  printf("loaded %d tables\n", tables);
+  return true;
+}
+
+/*! Read a response from stdin, keeping the link alive while waiting */
+static bool readResponse(int32_t *response) {
+  struct pollfd pfd = { .fd = STDIN_FILENO, .events = POLLIN };
+  char line[64];
+
+  while (poll(&pfd, 1, KEEPALIVE_MS) == 0)
+    sendPacket(CRTP_HEADER(CRTP_PORT_LINK, CRTP_SRV_LINK_SINK), NULL, 0);
+  if (!fgets(line, sizeof(line), stdin))
+    return false;
+  *response = strtol(line, NULL, 10);
+  return true;
+}
+
+static bool sweep(uint8_t motor, uint8_t direction, uint8_t steps, uint16_t settle) {
+  MotorcalSweep request = { MOTORCAL_CMD_SWEEP, motor, direction, steps, settle };
+  uint8_t abort[] = { MOTORCAL_CMD_ABORT };
+  MotorcalSample sample;
+  int32_t response;
+  Reply *r;
+
+  replyTail = replyHead;
+  if (!sendCommand(&request, sizeof(request)))
+    return false;
+  printf("sweep motor %u direction %u: enter the measured response at each step\n", motor, direction);
+
+  for (int done = 0; done < steps; done++) {
+    /*! The answer to the sweep comes early when it failed on the car */
+    while ((r = waitAny(REPLY_TIMEOUT_NS + settle * 1000000LL)) && r->data[0] != MOTORCAL_CMD_SAMPLE &&
+           r->data[0] != MOTORCAL_CMD_SWEEP)
+      ;
+    if (!r || r->data[0] != MOTORCAL_CMD_SAMPLE || r->size != sizeof(sample)) {
+      fprintf(stderr, "sweep: %s\n", r ? statusName(r->data[1]) : "no answer");
+      return false;
+    }
+    memcpy(&sample, r->data, sizeof(sample));
+    printf("step %2u/%u output %5u: ", sample.step + 1, steps, sample.output);
+    fflush(stdout);
+    if (!readResponse(&response)) {
+      sendCommand(abort, sizeof(abort));
+      fprintf(stderr, "sweep: aborted\n");
+      return false;
+    }
+    sample.response = response;
+    sendCommand(&sample, sizeof(sample));
+  }
+
+  r = waitReply(MOTORCAL_CMD_SWEEP, REPLY_TIMEOUT_NS);
+  if (!r || r->data[1] != MOTORCAL_OK) {
+    fprintf(stderr, "sweep: %s\n", r ? statusName(r->data[1]) : "no answer");
+    return false;
+  }
+  printf("motor %u direction %u calibrated\n", motor, direction);
+  return true;
+}
+
+static void usage(const char *name) {
+  fprintf(stderr, "Usage: %s [-R] [-w file] [-s motor:direction] [-n steps] [-d ms] [-r file] device\n"
+                  "  -R  default tables on all motors\n"
+                  "  -w  load the tables of a file into the car\n"
+                  "  -s  sweep one motor, direction 0 forward or 1 backward\n"
+                  "  -n  sweep steps, 3 to %d (17)\n"
+                  "  -d  settle time at each step in ms (500)\n"
+                  "  -r  save the tables of the car to a file\n",
+          name, MOTORCAL_SWEEP_MAX_STEPS);
+  exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv) {
+  const char *savePath = NULL, *loadPath = NULL;
+  int sweepMotor = -1, sweepDirection = 0, steps = 17, settle = 500;
+  bool reset = false, ok = true;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "Rw:s:n:d:r:")) != -1) {
+    switch (opt) {
+      case 'R': reset = true; break;
+      case 'w': loadPath = optarg; break;
+      case 's':
+        if (sscanf(optarg, "%d:%d", &sweepMotor, &sweepDirection) != 2)
+          usage(argv[0]);
+        break;
+      case 'n': steps = atoi(optarg); break;
+      case 'd': settle = atoi(optarg); break;
+      case 'r': savePath = optarg; break;
+      default: usage(argv[0]);
+    }
+  }
+  if (optind != argc - 1 || steps < 3 || steps > MOTORCAL_SWEEP_MAX_STEPS || settle < 0 || settle > 0xFFFF ||
+      (sweepMotor >= 0 && (sweepMotor >= MOTOR_NBR || sweepDirection < 0 || sweepDirection > 1)))
+    usage(argv[0]);
+
+  fd = openLink(argv[optind]);
+  if (fd < 0) {
+    perror(argv[optind]);
+    return EXIT_FAILURE;
+  }
+  syslinkParserInit(&parser);
+
+  if (ok && reset) {
+    uint8_t request[] = { MOTORCAL_CMD_RESET };
+    ok = command(request, sizeof(request), "reset");
+  }
+  if (ok && loadPath)
+    ok = load(loadPath);
+  if (ok && sweepMotor >= 0)
+    ok = sweep(sweepMotor, sweepDirection, steps, settle);
+  if (ok && savePath)
+    ok = save(savePath);
+
+  close(fd);
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
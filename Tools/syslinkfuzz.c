@@ -0,0 +1,278 @@
+/*
+ * syslinkfuzz - fuzz and benchmark the syslink frame parser.
+ *
+ * Runs syslinkParseByte() over generated byte streams:
+ *  - clean: valid frames of random type, length and data. Every frame must
+ *    come out once, unchanged and in order, and no error may be counted.
+ *  - corrupt: the same frames with bit flips, dropped and inserted bytes,
+ *    random garbage and frames whose LEN exceeds SYSLINK_MTU (with a correct
+ *    checksum over the overlong data). Every frame the parser accepts is
+ *    checked against the last bytes of the stream: start bytes, LEN at most
+ *    SYSLINK_MTU, the payload it returned and the Fletcher checksum.
+ *  - bench: parser throughput over a clean stream, in bytes/s.
+ *
+ * Usage: syslinkfuzz [-n frames] [-s seed]
+ * Exits with 1 on the first violation, after printing the offending frame.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "syslink.h"
+
+#define HISTORY_SIZE 64   //< Power of two, larger than the largest frame
+#define BENCH_BYTES (64u << 20)
+
+typedef struct {
+  uint8_t *data;
+  size_t len;
+  size_t size;
+} Stream;
+
+static uint32_t rngState;
+
+static uint32_t rng(void) {
+  /*! xorshift32, reproducible from the seed */
+  rngState ^= rngState << 13;
+  rngState ^= rngState >> 17;
+  rngState ^= rngState << 5;
+  return rngState;
+}
+
+static double now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void streamPut(Stream *s, const uint8_t *data, size_t len) {
+  if (s->len + len > s->size) {
+    s->size = (s->len + len) * 2;
+    s->data = realloc(s->data, s->size);
+    if (!s->data) {
+      perror("realloc");
+      exit(EXIT_FAILURE);
+    }
+  }
+  memcpy(&s->data[s->len], data, len);
+  s->len += len;
+}
+
+static void randomPacket(SyslinkPacket *p) {
+  p->type = rng();
+  p->length = rng() % (SYSLINK_MTU + 1);
+  for (int i = 0; i < p->length; i++)
+    p->data[i] = rng();
+}
+
+/*! Any length up to 255, checksummed like a valid frame */
+static int encodeAnyLength(uint8_t *buf, uint8_t type, const uint8_t *data, uint8_t length) {
+  uint8_t ck0 = 0, ck1 = 0;
+
+  buf[0] = SYSLINK_START_BYTE1;
+  buf[1] = SYSLINK_START_BYTE2;
+  buf[2] = type;
+  buf[3] = length;
+  memcpy(&buf[4], data, length);
+  for (int i = 2; i < 4 + length; i++) {
+    ck0 += buf[i];
+    ck1 += ck0;
+  }
+  buf[4 + length] = ck0;
+  buf[5 + length] = ck1;
+  return SYSLINK_FRAME_SIZE(length);
+}
+
+static int fail(const char *what, const SyslinkPacket *p, size_t offset) {
+  fprintf(stderr, "FAIL: %s at byte %zu, type 0x%02X length %u\n", what, offset, p->type, p->length);
+  return 1;
+}
+
+static int fuzzClean(uint32_t frames) {
+  SyslinkPacket *sent = malloc(frames * sizeof(*sent));
+  uint8_t frame[SYSLINK_FRAME_SIZE(SYSLINK_MTU)];
+  Stream s = { 0 };
+  SyslinkParser ps;
+  uint32_t got = 0;
+
+  for (uint32_t i = 0; i < frames; i++) {
+    randomPacket(&sent[i]);
+    streamPut(&s, frame, syslinkEncode(frame, sizeof(frame), sent[i].type, sent[i].data, sent[i].length));
+  }
+
+  syslinkParserInit(&ps);
+  for (size_t i = 0; i < s.len; i++) {
+    if (!syslinkParseByte(&ps, s.data[i]))
+      continue;
+    if (got == frames || ps.packet.type != sent[got].type || ps.packet.length != sent[got].length ||
+        memcmp(ps.packet.data, sent[got].data, ps.packet.length))
+      return fail("clean stream frame differs", &ps.packet, i);
+    got++;
+  }
+  if (got != frames || ps.errors) {
+    fprintf(stderr, "FAIL: clean stream gave %u of %u frames, %u errors\n", got, frames, ps.errors);
+    return 1;
+  }
+  printf("clean    %u frames, %zu bytes: all received, 0 errors\n", frames, s.len);
+  free(sent);
+  free(s.data);
+  return 0;
+}
+
+static void corruptFrame(Stream *s, const uint8_t *frame, int len) {
+  uint8_t buf[SYSLINK_FRAME_SIZE(255)];
+  uint8_t junk[16];
+  int n;
+
+  switch (rng() % 8) {
+    case 0:   /*! One flipped bit anywhere, start bytes and checksum included */
+      memcpy(buf, frame, len);
+      buf[rng() % len] ^= 1 << (rng() % 8);
+      streamPut(s, buf, len);
+      break;
+    case 1:   /*! One byte dropped */
+      n = rng() % len;
+      memcpy(buf, frame, n);
+      memcpy(&buf[n], &frame[n + 1], len - n - 1);
+      streamPut(s, buf, len - 1);
+      break;
+    case 2:   /*! One byte inserted */
+      n = rng() % (len + 1);
+      memcpy(buf, frame, n);
+      buf[n] = rng();
+      memcpy(&buf[n + 1], &frame[n], len - n);
+      streamPut(s, buf, len + 1);
+      break;
+    case 3:   /*! Garbage, biased towards start bytes */
+      n = 1 + rng() % sizeof(junk);
+      for (int i = 0; i < n; i++)
+        junk[i] = rng() % 4 == 0 ? (rng() & 1 ? SYSLINK_START_BYTE1 : SYSLINK_START_BYTE2) : rng();
+      streamPut(s, junk, n);
+      streamPut(s, frame, len);
+      break;
+    case 4: { /*! Overlong LEN with a correct checksum, must be refused */
+      uint8_t data[255];
+      uint8_t length = SYSLINK_MTU + 1 + rng() % (255 - SYSLINK_MTU);
+      for (int i = 0; i < length; i++)
+        data[i] = rng();
+      streamPut(s, buf, encodeAnyLength(buf, rng(), data, length));
+      break;
+    }
+    case 5:   /*! Truncated frame */
+      streamPut(s, frame, rng() % len);
+      break;
+    default:  /*! Intact */
+      streamPut(s, frame, len);
+      break;
+  }
+}
+
+/*! Check an accepted frame against the bytes that ended at 'end' in the stream */
+static int checkAccepted(const uint8_t *history, size_t end, const SyslinkParser *ps) {
+  const SyslinkPacket *p = &ps->packet;
+  uint8_t frame[SYSLINK_FRAME_SIZE(255)];
+  int len = SYSLINK_FRAME_SIZE(p->length);
+  uint8_t ck0 = 0, ck1 = 0;
+
+  if (p->length > SYSLINK_MTU)
+    return fail("overlong frame accepted", p, end);
+  if (end + 1 < (size_t)len)
+    return fail("frame accepted before enough bytes", p, end);
+  for (int i = 0; i < len; i++)
+    frame[i] = history[(end + 1 - len + i) % HISTORY_SIZE];
+
+  if (frame[0] != SYSLINK_START_BYTE1 || frame[1] != SYSLINK_START_BYTE2)
+    return fail("frame accepted without start bytes", p, end);
+  if (frame[2] != p->type || frame[3] != p->length || memcmp(&frame[4], p->data, p->length))
+    return fail("accepted frame differs from the stream", p, end);
+  for (int i = 2; i < 4 + p->length; i++) {
+    ck0 += frame[i];
+    ck1 += ck0;
+  }
+  if (frame[4 + p->length] != ck0 || frame[5 + p->length] != ck1)
+    return fail("frame with a bad checksum accepted", p, end);
+  return 0;
+}
+
+static int fuzzCorrupt(uint32_t frames) {
+  uint8_t frame[SYSLINK_FRAME_SIZE(SYSLINK_MTU)];
+  uint8_t history[HISTORY_SIZE];
+  SyslinkPacket p;
+  Stream s = { 0 };
+  SyslinkParser ps;
+  uint32_t accepted = 0;
+  int len;
+
+  for (uint32_t i = 0; i < frames; i++) {
+    randomPacket(&p);
+    len = syslinkEncode(frame, sizeof(frame), p.type, p.data, p.length);
+    corruptFrame(&s, frame, len);
+  }
+
+  syslinkParserInit(&ps);
+  for (size_t i = 0; i < s.len; i++) {
+    history[i % HISTORY_SIZE] = s.data[i];
+    if (!syslinkParseByte(&ps, s.data[i]))
+      continue;
+    if (checkAccepted(history, i, &ps))
+      return 1;
+    accepted++;
+  }
+  printf("corrupt  %u frames, %zu bytes: %u accepted, all valid, %u errors counted\n",
+         frames, s.len, accepted, ps.errors);
+  free(s.data);
+  return 0;
+}
+
+static void bench(void) {
+  uint8_t frame[SYSLINK_FRAME_SIZE(SYSLINK_MTU)];
+  volatile uint32_t accepted = 0;
+  SyslinkPacket p;
+  Stream s = { 0 };
+  SyslinkParser ps;
+  double start, seconds;
+  uint64_t bytes = 0;
+
+  while (s.len < (1 << 20)) {
+    randomPacket(&p);
+    streamPut(&s, frame, syslinkEncode(frame, sizeof(frame), p.type, p.data, p.length));
+  }
+
+  syslinkParserInit(&ps);
+  start = now();
+  while (bytes < BENCH_BYTES) {
+    for (size_t i = 0; i < s.len; i++)
+      accepted += syslinkParseByte(&ps, s.data[i]);
+    bytes += s.len;
+  }
+  seconds = now() - start;
+  printf("bench    %llu bytes in %.3f s: %.1f MB/s, %.1f M frames/s\n", (unsigned long long)bytes, seconds,
+         bytes / seconds / 1e6, accepted / seconds / 1e6);
+  free(s.data);
+}
+
+int main(int argc, char **argv) {
+  uint32_t frames = 200000;
+  uint32_t seed = time(NULL);
+  int opt;
+
+  while ((opt = getopt(argc, argv, "n:s:")) != -1) {
+    switch (opt) {
+      case 'n': frames = strtoul(optarg, NULL, 0); break;
+      case 's': seed = strtoul(optarg, NULL, 0); break;
+      default:
+        fprintf(stderr, "Usage: %s [-n frames] [-s seed]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+  }
+  rngState = seed ? seed : 1;
+  printf("seed %u\n", seed);
+
+  if (fuzzClean(frames) || fuzzCorrupt(frames))
+    return EXIT_FAILURE;
+  bench();
+  return EXIT_SUCCESS;
+}
@@ -23,7 +23,6 @@
 #include "usbd_cdc_if.h"
 
 /* USER CODE BEGIN INCLUDE */
-#include "crtp.h"
 #include "usblink.h"
 /* USER CODE END INCLUDE */
 
@@ -33,7 +32,6 @@
 
 /* USER CODE BEGIN PV */
 /* Private variables ---------------------------------------------------------*/
-static CRTPPacket p;
 /* USER CODE END PV */
 
 /** @addtogroup STM32_USB_OTG_DEVICE_LIBRARY
@@ -157,6 +155,9 @@ static int8_t CDC_Init_FS(void)
   /* Set Application Buffers */
   USBD_CDC_SetTxBuffer(&hUsbDeviceFS, UserTxBufferFS, 0);
   USBD_CDC_SetRxBuffer(&hUsbDeviceFS, UserRxBufferFS);
+  /* A transfer in flight before a reconfiguration will never complete. The
+   * next one is started by usblinkTask, once USBD_CDC_Init has reset TxState */
+  usblinkTxResetFromISR();
   return (USBD_OK);
   /* USER CODE END 3 */
 }
@@ -263,16 +264,12 @@ static int8_t CDC_Control_FS(uint8_t cmd, uint8_t* pbuf, uint16_t length)
 static int8_t CDC_Receive_FS(uint8_t* Buf, uint32_t *Len)
 {
   /* USER CODE BEGIN 6 */
-  USBD_CDC_SetRxBuffer(&hUsbDeviceFS, &Buf[0]);
-  USBD_CDC_ReceivePacket(&hUsbDeviceFS);
-
-  // guojun: test
-  USBD_CDC_SetTxBuffer(&hUsbDeviceFS, Buf, *Len);
-  USBD_CDC_TransmitPacket(&hUsbDeviceFS);
-
-  p.size = *Len - 1;
-  memcpy(&p.raw, Buf, *Len);
-  usblinkMessagePut(&p);
+  /* Copy into the usblink ring and rearm, unless the ring is full */
+  if (usblinkReceiveFromISR(Buf, *Len))
+  {
+    USBD_CDC_SetRxBuffer(&hUsbDeviceFS, &Buf[0]);
+    USBD_CDC_ReceivePacket(&hUsbDeviceFS);
+  }
   return (USBD_OK);
   /* USER CODE END 6 */
 }
@@ -293,6 +290,9 @@ uint8_t CDC_Transmit_FS(uint8_t* Buf, uint16_t Len)
   uint8_t result = USBD_OK;
   /* USER CODE BEGIN 7 */
   USBD_CDC_HandleTypeDef *hcdc = (USBD_CDC_HandleTypeDef*)hUsbDeviceFS.pClassData;
+  if (hcdc == NULL){
+    return USBD_FAIL;
+  }
   if (hcdc->TxState != 0){
     return USBD_BUSY;
   }
@@ -321,11 +321,37 @@ static int8_t CDC_TransmitCplt_FS(uint8_t *Buf, uint32_t *Len, uint8_t epnum)
   UNUSED(Buf);
   UNUSED(Len);
   UNUSED(epnum);
+  usblinkTxDoneFromISR();
   /* USER CODE END 13 */
   return result;
 }
 
 /* USER CODE BEGIN PRIVATE_FUNCTIONS_IMPLEMENTATION */
+/**
+  * @brief  CDC_ResumeReceive_FS
+  *         Arm the OUT endpoint again after CDC_Receive_FS left it paused.
+  *         Called from task context, so the USB interrupt is held off while
+  *         the endpoint is prepared.
+  * @retval None
+  */
+void CDC_ResumeReceive_FS(void)
+{
+  HAL_NVIC_DisableIRQ(OTG_FS_IRQn);
+  USBD_CDC_SetRxBuffer(&hUsbDeviceFS, UserRxBufferFS);
+  USBD_CDC_ReceivePacket(&hUsbDeviceFS);
+  HAL_NVIC_EnableIRQ(OTG_FS_IRQn);
+}
+
+/**
+  * @brief  CDC_IsConfigured_FS
+  *         Whether the host has enumerated and configured the device, from
+  *         then on until a reset or the cable is removed.
+  * @retval 1 if configured, else 0
+  */
+uint8_t CDC_IsConfigured_FS(void)
+{
+  return hUsbDeviceFS.dev_state == USBD_STATE_CONFIGURED;
+}
 
 /* USER CODE END PRIVATE_FUNCTIONS_IMPLEMENTATION */
 